@@ -0,0 +1,112 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/anomaly_detector.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+
+namespace ocpdiag::error_monitor {
+
+namespace {
+
+constexpr uint64_t kEwmaRateBit = 1 << RateAnomalyDetector::kEwmaRate;
+constexpr uint64_t kCusumBit = 1 << RateAnomalyDetector::kCusum;
+
+// x86-64 builds carry an AVX2 clone of the update loop, picked at load time
+// on hosts that support it; others run the baseline SSE2 clone.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define ERROR_MONITOR_TARGET_CLONES \
+  __attribute__((target_clones("avx2", "default")))
+#else
+#define ERROR_MONITOR_TARGET_CLONES
+#endif
+
+// One detector step for every counter. Kept as a call-free, branch-free loop
+// over non-aliasing arrays of equal-width lanes so that it vectorizes; the
+// BUILD target compiles this file at -O3 for that.
+ERROR_MONITOR_TARGET_CLONES
+void UpdateCounters(size_t n, const double* __restrict value,
+                    double* __restrict previous, double* __restrict rate,
+                    double* __restrict ewma, double* __restrict cusum,
+                    uint64_t* __restrict alarmed, uint64_t* __restrict raised,
+                    double per_hour, double alpha, double cusum_slack,
+                    double ewma_threshold, double cusum_threshold) {
+  for (size_t i = 0; i < n; ++i) {
+    // Counters that went backwards were reset; treat as no new errors.
+    double increase = value[i] - previous[i];
+    rate[i] = (increase > 0 ? increase : 0) * per_hour;
+    previous[i] = value[i];
+    double sum = cusum[i] + rate[i] - ewma[i] - cusum_slack;
+    cusum[i] = sum > 0 ? sum : 0;
+    ewma[i] += alpha * (rate[i] - ewma[i]);
+    uint64_t now = (ewma[i] > ewma_threshold ? kEwmaRateBit : 0) |
+                   (cusum[i] > cusum_threshold ? kCusumBit : 0);
+    raised[i] = now & ~alarmed[i];
+    alarmed[i] |= now;
+  }
+}
+
+}  // namespace
+
+RateAnomalyDetector::RateAnomalyDetector(const AnomalyDetection& options,
+                                         int size)
+    : alpha_(options.ewma_alpha()),
+      // A zero threshold disables the detector.
+      ewma_threshold_(options.ewma_rate_per_hour() > 0
+                          ? options.ewma_rate_per_hour()
+                          : std::numeric_limits<double>::infinity()),
+      cusum_slack_(options.cusum_slack_per_hour()),
+      cusum_threshold_(options.cusum_threshold_per_hour() > 0
+                           ? options.cusum_threshold_per_hour()
+                           : std::numeric_limits<double>::infinity()),
+      previous_(size),
+      rate_(size),
+      ewma_(size),
+      cusum_(size),
+      alarmed_(size),
+      raised_(size) {}
+
+std::vector<RateAnomalyDetector::Alarm> RateAnomalyDetector::Update(
+    absl::Span<const double> values, absl::Duration elapsed) {
+  const size_t n = previous_.size();
+  std::vector<Alarm> alarms;
+  if (!primed_ || elapsed <= absl::ZeroDuration()) {
+    std::copy_n(values.begin(), n, previous_.begin());
+    primed_ = true;
+    return alarms;
+  }
+
+  UpdateCounters(n, values.data(), previous_.data(), rate_.data(),
+                 ewma_.data(), cusum_.data(), alarmed_.data(), raised_.data(),
+                 1.0 / absl::ToDoubleHours(elapsed), alpha_, cusum_slack_,
+                 ewma_threshold_, cusum_threshold_);
+
+  for (size_t i = 0; i < n; ++i) {
+    if (raised_[i] == 0) continue;
+    for (Kind kind : {kEwmaRate, kCusum}) {
+      if (raised_[i] & (1 << kind)) {
+        alarms.push_back({static_cast<int>(i), kind, rate_[i]});
+      }
+    }
+  }
+  return alarms;
+}
+
+}  // namespace ocpdiag::error_monitor
@@ -0,0 +1,80 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_ANOMALY_DETECTOR_H_
+#define OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_ANOMALY_DETECTOR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "error_monitor/params.pb.h"
+
+namespace ocpdiag::error_monitor {
+
+// Streaming error-rate detectors over all counters of a module.
+//
+// Each poll, the increase of every counter is turned into a rate (errors/hour)
+// and fed to two detectors:
+//  * EWMA: alarms when the smoothed rate exceeds `ewma_rate_per_hour`.
+//  * CUSUM: accumulates how far the rate exceeds the EWMA baseline plus
+//    `cusum_slack_per_hour`, and alarms when the sum exceeds
+//    `cusum_threshold_per_hour`. This catches a rate that starts accelerating
+//    well before the smoothed rate gets there.
+// State is kept as packed per-counter arrays and updated in branch-free loops
+// so the compiler can vectorize them. Each detector alarms at most once per
+// counter.
+class RateAnomalyDetector {
+ public:
+  enum Kind { kEwmaRate, kCusum };
+
+  struct Alarm {
+    // Position of the counter in the values passed to Update().
+    int index;
+    Kind kind;
+    // Rate at the poll that raised the alarm, in errors/hour.
+    double rate_per_hour;
+  };
+
+  // `options` must have been validated. `size` is the number of counters.
+  RateAnomalyDetector(const AnomalyDetection& options, int size);
+
+  // Feeds the current value of every counter, `elapsed` after the previous
+  // call. `values` must hold `size` values, in the same order every call.
+  // Returns the alarms raised by this poll. The first call only records the
+  // values.
+  std::vector<Alarm> Update(absl::Span<const double> values,
+                            absl::Duration elapsed);
+
+ private:
+  const double alpha_;
+  const double ewma_threshold_;
+  const double cusum_slack_;
+  const double cusum_threshold_;
+  bool primed_ = false;
+
+  std::vector<double> previous_;
+  std::vector<double> rate_;
+  std::vector<double> ewma_;
+  std::vector<double> cusum_;
+  // Per counter alarm bits, indexed by 1 << Kind. Same width as the rates so
+  // the update loop vectorizes.
+  std::vector<uint64_t> alarmed_;
+  std::vector<uint64_t> raised_;
+};
+
+}  // namespace ocpdiag::error_monitor
+
+#endif  // OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_ANOMALY_DETECTOR_H_
@@ -0,0 +1,64 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the cost of one RateAnomalyDetector poll over many counters.
+
+#include <cstdio>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "error_monitor/anomaly_detector.h"
+#include "error_monitor/params.pb.h"
+
+namespace ocpdiag::error_monitor {
+namespace {
+
+void Run(int counters, int polls) {
+  AnomalyDetection options;
+  options.set_ewma_alpha(0.2);
+  options.set_ewma_rate_per_hour(100);
+  options.set_cusum_slack_per_hour(1);
+  options.set_cusum_threshold_per_hour(50);
+  RateAnomalyDetector detector(options, counters);
+
+  std::vector<double> values(counters);
+  detector.Update(values, absl::Minutes(5));
+  size_t alarms = 0;
+  absl::Duration elapsed;
+  for (int poll = 1; poll <= polls; ++poll) {
+    // Mostly quiet counters, with a few climbing fast enough to alarm.
+    for (int i = 0; i < counters; ++i) {
+      values[i] += i % 1000 == 0 ? 20 : (poll + i) % 7 == 0;
+    }
+    const absl::Time start = absl::Now();
+    alarms += detector.Update(values, absl::Minutes(5)).size();
+    elapsed += absl::Now() - start;
+  }
+  std::printf("%7d counters %5d polls  %9.1f us/poll  %6.2f ns/counter  %zu "
+              "alarms\n",
+              counters, polls, absl::ToDoubleMicroseconds(elapsed) / polls,
+              absl::ToDoubleNanoseconds(elapsed) / polls / counters, alarms);
+}
+
+}  // namespace
+}  // namespace ocpdiag::error_monitor
+
+int main() {
+  using ::ocpdiag::error_monitor::Run;
+  Run(1000, 10000);
+  Run(100000, 1000);
+  Run(1000000, 100);
+  return 0;
+}
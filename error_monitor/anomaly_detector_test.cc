@@ -0,0 +1,103 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/anomaly_detector.h"
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "error_monitor/params.pb.h"
+
+namespace ocpdiag::error_monitor {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::FieldsAre;
+using ::testing::IsEmpty;
+
+using Alarm = RateAnomalyDetector::Alarm;
+
+AnomalyDetection Options(double alpha, double ewma_rate, double cusum_slack,
+                         double cusum_threshold) {
+  AnomalyDetection options;
+  options.set_ewma_alpha(alpha);
+  options.set_ewma_rate_per_hour(ewma_rate);
+  options.set_cusum_slack_per_hour(cusum_slack);
+  options.set_cusum_threshold_per_hour(cusum_threshold);
+  return options;
+}
+
+TEST(RateAnomalyDetectorTest, FirstCallOnlyPrimes) {
+  RateAnomalyDetector detector(Options(1, 10, 1, 5), 2);
+  // Large absolute values are history from before monitoring started.
+  EXPECT_THAT(detector.Update({1e6, 1e9}, absl::Hours(1)), IsEmpty());
+  EXPECT_THAT(detector.Update({1e6, 1e9}, absl::Hours(1)), IsEmpty());
+}
+
+TEST(RateAnomalyDetectorTest, NonPositiveElapsedRePrimes) {
+  RateAnomalyDetector detector(Options(1, 10, 1, 0), 1);
+  EXPECT_THAT(detector.Update({0}, absl::Hours(1)), IsEmpty());
+  EXPECT_THAT(detector.Update({100}, absl::ZeroDuration()), IsEmpty());
+  EXPECT_THAT(detector.Update({105}, absl::Hours(1)), IsEmpty());
+}
+
+TEST(RateAnomalyDetectorTest, EwmaAlarmsOncePerCounter) {
+  RateAnomalyDetector detector(Options(1, 10, 1, 0), 3);
+  detector.Update({0, 0, 0}, absl::Hours(1));
+  EXPECT_THAT(detector.Update({5, 20, 0}, absl::Hours(1)),
+              ElementsAre(FieldsAre(1, RateAnomalyDetector::kEwmaRate, 20)));
+  // Still above the threshold, but already reported.
+  EXPECT_THAT(detector.Update({10, 40, 0}, absl::Hours(1)), IsEmpty());
+  EXPECT_THAT(detector.Update({10, 40, 30}, absl::Minutes(30)),
+              ElementsAre(FieldsAre(2, RateAnomalyDetector::kEwmaRate, 60)));
+}
+
+TEST(RateAnomalyDetectorTest, CusumAlarmsBeforeEwma) {
+  RateAnomalyDetector detector(Options(0.2, 10, 1, 20), 1);
+  detector.Update({0}, absl::Hours(1));
+  // A steady 15/hour: CUSUM accumulates 14 then 25, while the EWMA only
+  // crosses 10 on the fifth poll.
+  std::vector<std::vector<Alarm>> alarms;
+  for (int poll = 1; poll <= 5; ++poll) {
+    alarms.push_back(detector.Update({15.0 * poll}, absl::Hours(1)));
+  }
+  EXPECT_THAT(alarms[0], IsEmpty());
+  EXPECT_THAT(alarms[1],
+              ElementsAre(FieldsAre(0, RateAnomalyDetector::kCusum, 15)));
+  EXPECT_THAT(alarms[2], IsEmpty());
+  EXPECT_THAT(alarms[3], IsEmpty());
+  EXPECT_THAT(alarms[4],
+              ElementsAre(FieldsAre(0, RateAnomalyDetector::kEwmaRate, 15)));
+}
+
+TEST(RateAnomalyDetectorTest, CounterResetIsNoIncrease) {
+  RateAnomalyDetector detector(Options(1, 10, 1, 0), 1);
+  detector.Update({100}, absl::Hours(1));
+  // Reset to zero, then counting again from the new value.
+  EXPECT_THAT(detector.Update({0}, absl::Hours(1)), IsEmpty());
+  EXPECT_THAT(detector.Update({5}, absl::Hours(1)), IsEmpty());
+  EXPECT_THAT(detector.Update({25}, absl::Hours(1)),
+              ElementsAre(FieldsAre(0, RateAnomalyDetector::kEwmaRate, 20)));
+}
+
+TEST(RateAnomalyDetectorTest, ZeroThresholdsDisable) {
+  RateAnomalyDetector detector(Options(1, 0, 0, 0), 1);
+  detector.Update({0}, absl::Hours(1));
+  EXPECT_THAT(detector.Update({1e9}, absl::Hours(1)), IsEmpty());
+}
+
+}  // namespace
+}  // namespace ocpdiag::error_monitor
@@ -0,0 +1,56 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_CLOCK_H_
+#define OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_CLOCK_H_
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::error_monitor {
+
+// Abstract time source for the polling loop. Injected so that recorded
+// captures can be replayed without waiting on the wall clock.
+class Clock {
+ public:
+  virtual ~Clock() = default;
+
+  // Returns the current time.
+  virtual absl::Time Now() = 0;
+  // Blocks (or pretends to block) for `duration`.
+  virtual void SleepFor(absl::Duration duration) = 0;
+};
+
+// Clock backed by the system time.
+class RealClock final : public Clock {
+ public:
+  absl::Time Now() final { return absl::Now(); }
+  void SleepFor(absl::Duration duration) final { absl::SleepFor(duration); }
+};
+
+// Clock that only advances when slept on. Sleeping returns immediately.
+class SimulatedClock final : public Clock {
+ public:
+  explicit SimulatedClock(absl::Time start) : now_(start) {}
+
+  absl::Time Now() final { return now_; }
+  void SleepFor(absl::Duration duration) final { now_ += duration; }
+
+ private:
+  absl::Time now_;
+};
+
+}  // namespace ocpdiag::error_monitor
+
+#endif  // OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_CLOCK_H_
@@ -0,0 +1,282 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/counter_history.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::error_monitor {
+
+namespace {
+
+uint64_t ZigZagEncode(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t ZigZagDecode(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void PutVarint(std::string& out, int64_t signed_value) {
+  uint64_t value = ZigZagEncode(signed_value);
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+int64_t GetVarint(absl::string_view data, size_t& pos) {
+  uint64_t value = 0;
+  for (int shift = 0; pos < data.size(); shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(data[pos++]);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) break;
+  }
+  return ZigZagDecode(value);
+}
+
+}  // namespace
+
+void CounterChunk::Append(int64_t time_ms, int64_t value) {
+  if (count_ == 0) {
+    first_time_ms_ = time_ms;
+    first_value_ = value;
+  } else {
+    int64_t delta_ms = time_ms - last_time_ms_;
+    PutVarint(data_, delta_ms - last_delta_ms_);
+    PutVarint(data_, value - last_value_);
+    last_delta_ms_ = delta_ms;
+  }
+  last_time_ms_ = time_ms;
+  last_value_ = value;
+  ++count_;
+}
+
+void CounterChunk::Decode(std::vector<CounterSample>& out) const {
+  if (count_ == 0) return;
+  int64_t time_ms = first_time_ms_;
+  int64_t delta_ms = 0;
+  int64_t value = first_value_;
+  out.push_back({absl::FromUnixMillis(time_ms), value});
+  size_t pos = 0;
+  for (int i = 1; i < count_; ++i) {
+    delta_ms += GetVarint(data_, pos);
+    time_ms += delta_ms;
+    value += GetVarint(data_, pos);
+    out.push_back({absl::FromUnixMillis(time_ms), value});
+  }
+}
+
+CounterSeries::CounterSeries(CounterHistory& history) : history_(history) {}
+
+int64_t CounterSeries::FloorByteSize() {
+  return sizeof(CounterSeries) +
+         kTierResolutions.size() *
+             (sizeof(CounterChunk) + CounterChunk().DataByteSize());
+}
+
+int64_t CounterSeries::TierByteSize(const Tier& tier) {
+  int64_t size = tier.capacity() * sizeof(CounterChunk);
+  for (const CounterChunk& chunk : tier) {
+    size += chunk.DataByteSize();
+  }
+  return size;
+}
+
+void CounterSeries::Append(absl::Time time, int64_t value) {
+  const int64_t time_ms = absl::ToUnixMillis(time);
+  const int64_t old_size = byte_size_;
+  for (size_t i = 0; i < tiers_.size(); ++i) {
+    Tier& tier = tiers_[i];
+    if (i > 0 && !tier.empty() &&
+        time_ms < tier.back().last_time_ms() +
+                      absl::ToInt64Milliseconds(kTierResolutions[i])) {
+      continue;
+    }
+    AppendToTier(tier, time_ms, value);
+  }
+  history_.byte_size_ += byte_size_ - old_size;
+  if (history_.byte_size_ > history_.budget_bytes_) {
+    history_.EnforceBudget();
+  }
+}
+
+void CounterSeries::AppendToTier(Tier& tier, int64_t time_ms, int64_t value) {
+  if (tier.empty() || tier.back().full()) {
+    if (!tier.empty()) {
+      CounterChunk& sealed = tier.back();
+      byte_size_ -= sealed.DataByteSize();
+      sealed.Seal();
+      byte_size_ += sealed.DataByteSize();
+      ++history_.sealed_chunks_;
+    }
+    byte_size_ -= tier.capacity() * sizeof(CounterChunk);
+    tier.emplace_back();
+    byte_size_ += tier.capacity() * sizeof(CounterChunk) +
+                  tier.back().DataByteSize();
+  }
+  CounterChunk& chunk = tier.back();
+  byte_size_ -= chunk.DataByteSize();
+  chunk.Append(time_ms, value);
+  byte_size_ += chunk.DataByteSize();
+}
+
+int64_t CounterSeries::Shed(bool restart_open_chunks) {
+  for (Tier& tier : tiers_) {
+    if (tier.size() > 1) {
+      // Drop an eighth of the sealed chunks at a time so that long tiers are
+      // not shifted down once per evicted chunk.
+      const size_t evicted = std::max<size_t>(1, (tier.size() - 1) / 8);
+      int64_t freed = 0;
+      for (size_t i = 0; i < evicted; ++i) {
+        freed += tier[i].DataByteSize();
+      }
+      tier.erase(tier.begin(), tier.begin() + evicted);
+      byte_size_ -= freed;
+      history_.sealed_chunks_ -= evicted;
+      return freed;
+    }
+  }
+  if (!restart_open_chunks) {
+    return 0;
+  }
+  for (Tier& tier : tiers_) {
+    if (tier.empty() ||
+        (tier.size() == 1 && tier.capacity() == 1 && tier.back().size() <= 1)) {
+      continue;
+    }
+    // Keep the last sample: it is the latest value, and the coarser tiers
+    // space their samples from it.
+    const int64_t old_size = TierByteSize(tier);
+    const CounterChunk& open = tier.back();
+    CounterChunk restarted;
+    restarted.Append(open.last_time_ms(), open.last_value());
+    Tier{}.swap(tier);
+    tier.push_back(std::move(restarted));
+    const int64_t freed = old_size - TierByteSize(tier);
+    byte_size_ -= freed;
+    return freed;
+  }
+  return 0;
+}
+
+std::vector<CounterSample> CounterSeries::Samples() const {
+  std::vector<CounterSample> samples;
+  for (const CounterChunk& chunk : tiers_[0]) {
+    chunk.Decode(samples);
+  }
+  // Fill in the periods evicted from finer tiers from the coarser ones.
+  for (size_t i = 1; i < tiers_.size(); ++i) {
+    std::vector<CounterSample> older;
+    for (const CounterChunk& chunk : tiers_[i]) {
+      chunk.Decode(older);
+    }
+    if (!samples.empty()) {
+      const absl::Time cutoff = samples.front().time;
+      older.erase(std::find_if(older.begin(), older.end(),
+                               [cutoff](const CounterSample& sample) {
+                                 return sample.time >= cutoff;
+                               }),
+                  older.end());
+    }
+    samples.insert(samples.begin(), older.begin(), older.end());
+  }
+  return samples;
+}
+
+std::optional<CounterSample> CounterSeries::Latest() const {
+  if (tiers_[0].empty()) return std::nullopt;
+  const CounterChunk& chunk = tiers_[0].back();
+  return CounterSample{absl::FromUnixMillis(chunk.last_time_ms()),
+                       chunk.last_value()};
+}
+
+std::optional<absl::Time> CounterSeries::FirstIncrease() const {
+  std::vector<CounterSample> samples = Samples();
+  for (size_t i = 1; i < samples.size(); ++i) {
+    if (samples[i].value > samples[i - 1].value) {
+      return samples[i].time;
+    }
+  }
+  return std::nullopt;
+}
+
+double CounterSeries::RatePerSecond(absl::Time since) const {
+  std::vector<CounterSample> samples = Samples();
+  auto first = std::find_if(
+      samples.begin(), samples.end(),
+      [since](const CounterSample& sample) { return sample.time >= since; });
+  if (first == samples.end() || first == samples.end() - 1) {
+    return 0;
+  }
+  const CounterSample& last = samples.back();
+  double secs = absl::ToDoubleSeconds(last.time - first->time);
+  if (secs <= 0) {
+    return 0;
+  }
+  return (last.value - first->value) / secs;
+}
+
+CounterSeries* CounterHistory::Track(absl::string_view key) {
+  auto [it, inserted] = series_.try_emplace(key, *this);
+  if (!inserted) {
+    return &it->second;
+  }
+  const int64_t key_size = sizeof(std::string) + it->first.capacity();
+  if (floor_bytes_ + key_size + CounterSeries::FloorByteSize() >
+      budget_bytes_) {
+    series_.erase(it);
+    return nullptr;
+  }
+  floor_bytes_ += key_size + CounterSeries::FloorByteSize();
+  byte_size_ += key_size + it->second.ByteSize();
+  shed_order_.push_back(&it->second);
+  return &it->second;
+}
+
+void CounterHistory::EnforceBudget() {
+  // Take sealed chunks from every series before cutting into open ones, and
+  // go round the series so that they all keep a similar span of history.
+  for (bool restart_open_chunks : {false, true}) {
+    if (!restart_open_chunks && sealed_chunks_ == 0) {
+      continue;
+    }
+    size_t idle = 0;
+    while (byte_size_ > budget_bytes_ && idle < shed_order_.size()) {
+      shed_next_ %= shed_order_.size();
+      int64_t freed = shed_order_[shed_next_++]->Shed(restart_open_chunks);
+      byte_size_ -= freed;
+      idle = freed > 0 ? 0 : idle + 1;
+    }
+  }
+}
+
+const CounterSeries* CounterHistory::Find(absl::string_view key) const {
+  auto it = series_.find(key);
+  if (it == series_.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+}  // namespace ocpdiag::error_monitor
@@ -0,0 +1,163 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_COUNTER_HISTORY_H_
+#define OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_COUNTER_HISTORY_H_
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/container/node_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::error_monitor {
+
+struct CounterSample {
+  absl::Time time;
+  int64_t value;
+};
+
+// Append-only compressed run of samples. The first sample is kept in the
+// header, later ones as zigzag varints of the timestamp delta-of-delta and
+// the value delta. Regular polling of a quiet counter costs 2 bytes/sample.
+class CounterChunk {
+ public:
+  // Samples per chunk before a new one is started.
+  static constexpr int kCapacity = 128;
+
+  void Append(int64_t time_ms, int64_t value);
+  // Releases spare buffer capacity once the chunk is full.
+  void Seal() { data_.shrink_to_fit(); }
+  // Appends the decoded samples to `out`.
+  void Decode(std::vector<CounterSample>& out) const;
+
+  bool full() const { return count_ >= kCapacity; }
+  int size() const { return count_; }
+  int64_t first_time_ms() const { return first_time_ms_; }
+  int64_t last_time_ms() const { return last_time_ms_; }
+  int64_t last_value() const { return last_value_; }
+  // Bytes of encoded data, excluding the chunk itself.
+  int64_t DataByteSize() const { return data_.capacity(); }
+
+ private:
+  std::string data_;
+  int count_ = 0;
+  int64_t first_time_ms_ = 0;
+  int64_t first_value_ = 0;
+  int64_t last_time_ms_ = 0;
+  int64_t last_delta_ms_ = 0;
+  int64_t last_value_ = 0;
+};
+
+class CounterHistory;
+
+// History of a single monotonic counter, kept at several resolutions. Every
+// sample goes to the finest tier; coarser tiers keep one sample per
+// resolution period. When the owning history is over budget the oldest
+// chunks are evicted from the finest tier first, so old history degrades to
+// coarser resolution rather than disappearing.
+class CounterSeries {
+ public:
+  // Minimum spacing of samples in each tier, finest first.
+  static constexpr std::array<absl::Duration, 3> kTierResolutions = {
+      absl::ZeroDuration(), absl::Hours(1), absl::Hours(24)};
+
+  explicit CounterSeries(CounterHistory& history);
+  CounterSeries(const CounterSeries&) = delete;
+  CounterSeries& operator=(const CounterSeries&) = delete;
+
+  void Append(absl::Time time, int64_t value);
+
+  // All retained samples in time order, at the finest resolution available
+  // for each period.
+  std::vector<CounterSample> Samples() const;
+  // Most recent sample, if any.
+  std::optional<CounterSample> Latest() const;
+  // Time of the first sample at which the counter was seen increasing.
+  std::optional<absl::Time> FirstIncrease() const;
+  // Average increase per second between the earliest retained sample at or
+  // after `since` and the latest sample. Zero if fewer than two samples.
+  double RatePerSecond(absl::Time since) const;
+
+  int64_t ByteSize() const { return byte_size_; }
+  // Size of a series shed down to its last sample in every tier.
+  static int64_t FloorByteSize();
+
+ private:
+  friend class CounterHistory;
+
+  using Tier = std::vector<CounterChunk>;
+
+  void AppendToTier(Tier& tier, int64_t time_ms, int64_t value);
+  // Frees the oldest data of the series and returns the bytes freed, or 0 if
+  // there is nothing left to free. Drops the oldest sealed chunks, finest
+  // tier first; with `restart_open_chunks`, then cuts open chunks back to
+  // their last sample.
+  int64_t Shed(bool restart_open_chunks);
+  static int64_t TierByteSize(const Tier& tier);
+
+  CounterHistory& history_;
+  std::array<Tier, kTierResolutions.size()> tiers_;
+  int64_t byte_size_ = sizeof(*this);
+};
+
+// Store of counter histories keyed by hardware identity, e.g. a PCIe link
+// address and error type, held within a fixed memory budget. Counters share
+// the budget: when an append takes the history over it, the oldest data is
+// shed from every series in turn. Each series needs at least
+// CounterSeries::FloorByteSize() plus its key, so the budget also caps the
+// number of series; beyond that, Track() refuses new ones. Allocator and
+// hash table overhead is not counted.
+class CounterHistory {
+ public:
+  explicit CounterHistory(int64_t budget_bytes) : budget_bytes_(budget_bytes) {}
+  CounterHistory(const CounterHistory&) = delete;
+  CounterHistory& operator=(const CounterHistory&) = delete;
+
+  // Returns the series for `key`, creating it if needed, or null if the
+  // budget cannot hold another series. The pointer stays valid for the
+  // lifetime of the history, so callers on the poll path should hold on to
+  // it rather than looking it up on every append.
+  CounterSeries* Track(absl::string_view key);
+  // Returns the series for `key`, or null if it is not tracked.
+  const CounterSeries* Find(absl::string_view key) const;
+
+  int64_t ByteSize() const { return byte_size_; }
+  int64_t budget_bytes() const { return budget_bytes_; }
+
+ private:
+  friend class CounterSeries;
+
+  // Sheds data until the history is within budget.
+  void EnforceBudget();
+
+  const int64_t budget_bytes_;
+  int64_t byte_size_ = sizeof(*this);
+  // Sum of the floors of the tracked series.
+  int64_t floor_bytes_ = sizeof(*this);
+  // Full chunks, which are shed before open ones.
+  int64_t sealed_chunks_ = 0;
+  absl::node_hash_map<std::string, CounterSeries> series_;
+  // Series in the order they are shed from, and the next one to shed.
+  std::vector<CounterSeries*> shed_order_;
+  size_t shed_next_ = 0;
+};
+
+}  // namespace ocpdiag::error_monitor
+
+#endif  // OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_COUNTER_HISTORY_H_
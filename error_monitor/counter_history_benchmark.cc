@@ -0,0 +1,84 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the cost of CounterHistory appends, with the history within its
+// budget and with every append shedding old data.
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "error_monitor/counter_history.h"
+
+namespace ocpdiag::error_monitor {
+namespace {
+
+struct Scenario {
+  const char* name;
+  int series;
+  int polls;
+  int64_t budget_bytes;
+};
+
+void Run(const Scenario& scenario) {
+  CounterHistory history(scenario.budget_bytes);
+  std::vector<CounterSeries*> tracked;
+  for (int i = 0; i < scenario.series; ++i) {
+    if (CounterSeries* series =
+            history.Track(absl::StrCat("0000:", i, ":00.0/correctable:BadTLP"));
+        series != nullptr) {
+      tracked.push_back(series);
+    }
+  }
+
+  const absl::Time start_time = absl::FromUnixSeconds(1632700800);
+  const absl::Time start = absl::Now();
+  for (int poll = 0; poll < scenario.polls; ++poll) {
+    const absl::Time time = start_time + absl::Minutes(5) * poll;
+    for (size_t i = 0; i < tracked.size(); ++i) {
+      // Mostly quiet counters, with an occasional burst.
+      const bool burst = static_cast<size_t>(poll) % 97 == i % 97;
+      tracked[i]->Append(time, poll / 50 + (burst ? 1000 : 0));
+    }
+  }
+  const absl::Duration elapsed = absl::Now() - start;
+
+  const int64_t appends = int64_t{scenario.polls} * tracked.size();
+  std::printf(
+      "%-22s %5zu/%5d series %7d polls  %6.1f ns/append  %8lld / %8lld "
+      "bytes\n",
+      scenario.name, tracked.size(), scenario.series, scenario.polls,
+      absl::ToDoubleNanoseconds(elapsed) / appends,
+      static_cast<long long>(history.ByteSize()),
+      static_cast<long long>(scenario.budget_bytes));
+}
+
+}  // namespace
+}  // namespace ocpdiag::error_monitor
+
+int main() {
+  using ::ocpdiag::error_monitor::Run;
+  std::printf("series floor: %lld bytes\n",
+              static_cast<long long>(
+                  ocpdiag::error_monitor::CounterSeries::FloorByteSize()));
+  Run({"single series", 1, 1000000, 1 << 20});
+  Run({"single unbounded", 1, 1000000, 1 << 30});
+  Run({"within budget", 4000, 500, 16 << 20});
+  Run({"shedding", 4000, 5000, 4 << 20});
+  Run({"over series budget", 5000, 5000, 1 << 20});
+  return 0;
+}
@@ -0,0 +1,177 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/counter_history.h"
+
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::error_monitor {
+namespace {
+
+using ::testing::Le;
+using ::testing::NotNull;
+
+const absl::Time kStart = absl::FromUnixSeconds(1632700800);
+
+TEST(CounterChunkTest, RoundTripsIrregularSamples) {
+  // Irregular spacing, counter resets, and deltas needing every varint
+  // length, in both directions.
+  const std::vector<std::pair<int64_t, int64_t>> input = {
+      {1632700800000, 0},
+      {1632700800001, 1},
+      {1632701100000, 4000},
+      {1632701100000, 4000},
+      {1632702000123, 0},
+      {1632702000124, std::numeric_limits<int64_t>::max() / 2},
+      {1632703000000, -(int64_t{1} << 40)},
+      {1733000000000, 7},
+      {1632700000000, 7},
+  };
+  CounterChunk chunk;
+  for (const auto& [time_ms, value] : input) {
+    chunk.Append(time_ms, value);
+  }
+  std::vector<CounterSample> decoded;
+  chunk.Decode(decoded);
+
+  ASSERT_EQ(decoded.size(), input.size());
+  for (size_t i = 0; i < input.size(); ++i) {
+    EXPECT_EQ(absl::ToUnixMillis(decoded[i].time), input[i].first) << i;
+    EXPECT_EQ(decoded[i].value, input[i].second) << i;
+  }
+  EXPECT_EQ(chunk.first_time_ms(), input.front().first);
+  EXPECT_EQ(chunk.last_time_ms(), input.back().first);
+  EXPECT_EQ(chunk.last_value(), input.back().second);
+}
+
+TEST(CounterChunkTest, QuietCounterCostsTwoBytesPerSample) {
+  CounterChunk chunk;
+  for (int i = 0; i < CounterChunk::kCapacity; ++i) {
+    chunk.Append(1632700800000 + i * int64_t{300000}, 42);
+  }
+  chunk.Seal();
+  EXPECT_TRUE(chunk.full());
+  EXPECT_LE(chunk.DataByteSize(), 2 * CounterChunk::kCapacity);
+}
+
+TEST(CounterSeriesTest, AnswersTrendQueries) {
+  CounterHistory history(1 << 20);
+  CounterSeries* series = history.Track("link/correctable:BadTLP");
+  ASSERT_THAT(series, NotNull());
+  EXPECT_FALSE(series->Latest().has_value());
+
+  for (int i = 0; i <= 24; ++i) {
+    // Quiet for 12 hours, then 10 errors an hour.
+    series->Append(kStart + absl::Hours(i), i <= 12 ? 3 : 3 + (i - 12) * 10);
+  }
+  EXPECT_EQ(series->Samples().size(), 25);
+  std::optional<CounterSample> latest = series->Latest();
+  ASSERT_TRUE(latest.has_value());
+  EXPECT_EQ(latest->time, kStart + absl::Hours(24));
+  EXPECT_EQ(latest->value, 123);
+  EXPECT_EQ(series->FirstIncrease(), kStart + absl::Hours(13));
+  EXPECT_DOUBLE_EQ(series->RatePerSecond(kStart + absl::Hours(12)) * 3600, 10);
+}
+
+TEST(CounterSeriesTest, EvictionKeepsOldHistoryAtCoarserResolution) {
+  CounterHistory history(8 << 10);
+  CounterSeries* series = history.Track("link/correctable:BadTLP");
+  ASSERT_THAT(series, NotNull());
+
+  // 30 days of 5-minute polls of a counter that increases every poll.
+  const int polls = 30 * 24 * 12;
+  for (int i = 0; i < polls; ++i) {
+    series->Append(kStart + absl::Minutes(5) * i, i);
+    ASSERT_THAT(history.ByteSize(), Le(history.budget_bytes()));
+  }
+
+  std::vector<CounterSample> samples = series->Samples();
+  ASSERT_GT(samples.size(), 2);
+  EXPECT_LT(samples.size(), polls);
+  // The start is still there, from the daily tier.
+  EXPECT_EQ(samples.front().time, kStart);
+  EXPECT_EQ(samples.front().value, 0);
+  EXPECT_EQ(samples.back().time, kStart + absl::Minutes(5) * (polls - 1));
+  for (size_t i = 1; i < samples.size(); ++i) {
+    ASSERT_GT(samples[i].time, samples[i - 1].time) << i;
+    // Values survive eviction exactly.
+    ASSERT_EQ(samples[i].value,
+              (samples[i].time - kStart) / absl::Minutes(5)) << i;
+  }
+  // Recent history is at full resolution, old history is not.
+  EXPECT_EQ(samples.back().time - samples[samples.size() - 2].time,
+            absl::Minutes(5));
+  EXPECT_GE(samples[1].time - samples[0].time, absl::Hours(1));
+  EXPECT_EQ(series->FirstIncrease(), samples[1].time);
+}
+
+TEST(CounterHistoryTest, StaysWithinBudgetWithManySeries) {
+  // About as many counters as a host with 100 links of 40 AER types.
+  const int64_t budget = 1 << 20;
+  CounterHistory history(budget);
+  std::vector<CounterSeries*> tracked;
+  int refused = 0;
+  for (int i = 0; i < 5000; ++i) {
+    CounterSeries* series =
+        history.Track(absl::StrCat("0000:", i, ":00.0/correctable:BadTLP"));
+    if (series == nullptr) {
+      ++refused;
+    } else {
+      tracked.push_back(series);
+    }
+  }
+  // The budget caps the number of series at its floor size.
+  EXPECT_GT(refused, 0);
+  EXPECT_GT(tracked.size(), budget / (2 * CounterSeries::FloorByteSize()));
+  EXPECT_THAT(history.ByteSize(), Le(budget));
+
+  for (int poll = 0; poll < 2000; ++poll) {
+    for (CounterSeries* series : tracked) {
+      series->Append(kStart + absl::Minutes(5) * poll, poll / 7);
+    }
+    ASSERT_THAT(history.ByteSize(), Le(budget)) << poll;
+  }
+  // Every series still knows its latest value.
+  for (CounterSeries* series : tracked) {
+    std::optional<CounterSample> latest = series->Latest();
+    ASSERT_TRUE(latest.has_value());
+    EXPECT_EQ(latest->value, 1999 / 7);
+  }
+}
+
+TEST(CounterHistoryTest, TrackReturnsExistingSeries) {
+  CounterHistory history(1 << 20);
+  CounterSeries* series = history.Track("a");
+  EXPECT_EQ(history.Track("a"), series);
+  EXPECT_EQ(history.Find("a"), series);
+  EXPECT_EQ(history.Find("b"), nullptr);
+}
+
+TEST(CounterHistoryTest, RefusesSeriesBeyondBudget) {
+  CounterHistory history(CounterSeries::FloorByteSize());
+  EXPECT_EQ(history.Track("a"), nullptr);
+  EXPECT_EQ(history.Find("a"), nullptr);
+}
+
+}  // namespace
+}  // namespace ocpdiag::error_monitor
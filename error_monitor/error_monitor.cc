@@ -14,17 +14,24 @@
 
 #include "error_monitor/error_monitor.h"
 
+#include <sched.h>
+
+#include <algorithm>
 #include <memory>
 
 #include "absl/algorithm/algorithm.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
 #include "absl/time/time.h"
 #include "ocpdiag/core/compat/status_macros.h"
 #include "ocpdiag/core/params/utils.h"
+#include "error_monitor/low_interference.h"
 #include "error_monitor/params.pb.h"
 #include "error_monitor/pcie_errors/pcie_error_step.h"
+#include "error_monitor/sysfs_counters/sysfs_counter_step.h"
 
 namespace ocpdiag::error_monitor {
 
@@ -45,6 +52,69 @@ absl::Status ValidateParametersAndSetDefault(bool require_dimm_name_map,
     return absl::InvalidArgumentError("Parameter 'runtime_secs' is negative.");
   }
 
+  if (params.history_budget_kib() == 0) {
+    params.set_history_budget_kib(kHistoryBudgetKibDefault);
+  } else if (params.history_budget_kib() < 0) {
+    return absl::InvalidArgumentError(
+        "Parameter 'history_budget_kib' is negative.");
+  }
+
+  if (params.has_anomaly_detection()) {
+    AnomalyDetection& detection = *params.mutable_anomaly_detection();
+    if (detection.ewma_alpha() == 0) {
+      detection.set_ewma_alpha(kEwmaAlphaDefault);
+    } else if (detection.ewma_alpha() < 0 || detection.ewma_alpha() > 1) {
+      return absl::InvalidArgumentError(
+          "Parameter 'anomaly_detection.ewma_alpha' is not in (0, 1].");
+    }
+    if (detection.cusum_slack_per_hour() == 0) {
+      detection.set_cusum_slack_per_hour(kCusumSlackPerHourDefault);
+    } else if (detection.cusum_slack_per_hour() < 0) {
+      return absl::InvalidArgumentError(
+          "Parameter 'anomaly_detection.cusum_slack_per_hour' is negative.");
+    }
+    if (detection.ewma_rate_per_hour() < 0) {
+      return absl::InvalidArgumentError(
+          "Parameter 'anomaly_detection.ewma_rate_per_hour' is negative.");
+    }
+    if (detection.cusum_threshold_per_hour() < 0) {
+      return absl::InvalidArgumentError(
+          "Parameter 'anomaly_detection.cusum_threshold_per_hour' is "
+          "negative.");
+    }
+  }
+
+  absl::flat_hash_set<std::string> sysfs_source_names;
+  for (const SysfsCounterSource& source : params.sysfs_counters()) {
+    if (source.name().empty()) {
+      return absl::InvalidArgumentError(
+          "Parameter 'sysfs_counters' has a source without a name.");
+    }
+    if (!sysfs_source_names.insert(source.name()).second) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "Parameter 'sysfs_counters' has duplicate source '%s'.",
+          source.name()));
+    }
+    if (source.globs().empty()) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "Parameter 'sysfs_counters' source '%s' has no globs.",
+          source.name()));
+    }
+    if (source.threshold().max_count_per_day() < 0) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "Parameter 'sysfs_counters' source '%s' has a negative threshold.",
+          source.name()));
+    }
+  }
+
+  for (int cpu : params.low_interference().housekeeping_cpus()) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "Parameter 'low_interference.housekeeping_cpus' has invalid cpu %d.",
+          cpu));
+    }
+  }
+
   return absl::OkStatus();
 }
 
@@ -75,36 +145,87 @@ absl::StatusOr<ErrorMonitor> ErrorMonitor::Create(
     ocpdiag::results::ResultApi& api,
     std::unique_ptr<ocpdiag::results::TestRun> test_run,
     SignalNotification& signal_stop) {
-  bool require_dimm_name_map = false;
+  auto params = absl::make_unique<Params>();
+  if (absl::Status status = params::GetParams(params.get()); !status.ok()) {
+    test_run->AddError("test-initialization-failed",
+                       absl::StrFormat("Failed to load params. status=[%s]",
+                                       status.ToString()));
+    return status;
+  }
 
-  absl::StatusOr<std::unique_ptr<Params>> params =
-      internal::LoadParameters(require_dimm_name_map);
-  if (!params.ok()) {
+  std::unique_ptr<ReplayCapture> replay;
+  if (!params->replay_path().empty()) {
+    absl::StatusOr<std::unique_ptr<ReplayCapture>> capture =
+        ReplayCapture::Load(params->replay_path());
+    if (!capture.ok()) {
+      test_run->AddError("test-initialization-failed",
+                         absl::StrFormat("Failed to load replay. status=[%s]",
+                                         capture.status().ToString()));
+      return capture.status();
+    }
+    replay = *std::move(capture);
+  }
+  return Create(api, std::move(test_run), std::move(params),
+                std::move(replay), signal_stop);
+}
+
+absl::StatusOr<ErrorMonitor> ErrorMonitor::Create(
+    ocpdiag::results::ResultApi& api,
+    std::unique_ptr<ocpdiag::results::TestRun> test_run,
+    std::unique_ptr<Params> params, std::unique_ptr<ReplayCapture> replay,
+    SignalNotification& signal_stop) {
+  bool require_dimm_name_map = false;
+  if (absl::Status status = internal::ValidateParametersAndSetDefault(
+          require_dimm_name_map, *params);
+      !status.ok()) {
     test_run->AddError("test-initialization-failed",
                        absl::StrFormat("Failed to load params. status=[%s]",
-                                       params.status().ToString()));
-    return params.status();
+                                       status.ToString()));
+    return status;
   }
 
-  absl::Span<const int> requested_monitors = (*params)->monitors();
+  absl::Span<const int> requested_monitors = params->monitors();
 
   results::TestRun& test_run_ref = *test_run;
-  const Params& params_ref = **params;
+  const Params& params_ref = *params;
+
+  std::unique_ptr<Clock> clock;
+  if (replay != nullptr) {
+    clock = std::make_unique<SimulatedClock>(replay->start_time());
+  } else {
+    clock = std::make_unique<RealClock>();
+  }
 
   absl::StatusOr<ErrorMonitor>
     monitor(absl::in_place_t(),
             api,
             std::move(test_run),
-            *std::move(params),
-            signal_stop);
+            std::move(params),
+            signal_stop,
+            std::move(clock));
+  if (replay != nullptr) {
+    monitor->readout_ =
+        std::make_unique<CaptureReadoutSource>(*replay, *monitor->clock_);
+    monitor->replay_ = std::move(replay);
+  }
 
   if (internal::MonitorIsRequested(requested_monitors, PCIE_ERROR_MONITOR)) {
     auto pcie_module = std::make_unique<PcieErrorMonitorModule>(
         api,
         test_run_ref,
-        params_ref);
+        params_ref,
+        *monitor->readout_,
+        *monitor->history_);
     monitor->AddModule(std::move(pcie_module));
   }
+  if (internal::MonitorIsRequested(requested_monitors,
+                                   SYSFS_COUNTER_MONITOR)) {
+    for (const SysfsCounterSource& source : params_ref.sysfs_counters()) {
+      monitor->AddModule(std::make_unique<SysfsCounterMonitorModule>(
+          api, test_run_ref, params_ref, source, *monitor->clock_,
+          *monitor->readout_, *monitor->history_));
+    }
+  }
   return monitor;
 }
 
@@ -119,35 +240,118 @@ void ErrorMonitor::ExecuteTest() {
 
 absl::Status ErrorMonitor::RealExecuteTest() {
   test_run_->LogInfo("Setup.");
+  if (params_->has_low_interference()) {
+    RETURN_IF_ERROR(EnterLowInterferenceMode(params_->low_interference()));
+  }
   RETURN_IF_ERROR(LoadHwInfos());
   test_run_->StartAndRegisterInfos(std::vector<results::DutInfo>{dut_info_},
                                    *params_);
 
+  // Started before the modules so that failing to bind the socket does not
+  // leave their steps open.
+  if (!params_->snapshot_socket_path().empty()) {
+    ASSIGN_OR_RETURN(snapshot_server_,
+                     SnapshotServer::Start(params_->snapshot_socket_path()));
+  }
   RETURN_IF_ERROR(StartMonitoring());
 
   absl::Duration polling_interval =
       absl::Seconds(params_->polling_interval_secs());
-  absl::Time previous_polling = absl::Now() - polling_interval;
+  absl::Time previous_polling = clock_->Now() - polling_interval;
   absl::Time end_time = absl::InfiniteFuture();
   if (int runtime = params_->runtime_secs(); runtime != 0) {
-    end_time = absl::Now() + absl::Seconds(runtime);
+    end_time = clock_->Now() + absl::Seconds(runtime);
+  }
+  if (replay_ != nullptr) {
+    end_time = std::min(end_time, replay_->end_time());
   }
 
-  while (!signal_stop_.HasBeenNotified() && absl::Now() <= end_time) {
-    absl::Time start = previous_polling + polling_interval;
-    while (!signal_stop_.HasBeenNotified() && absl::Now() < start) {
-      absl::SleepFor(absl::Milliseconds(100));
+  // In low-interference mode modules take turns across the interval rather
+  // than all polling at once, and each may spread its poll over its turn.
+  absl::Duration module_stagger = absl::ZeroDuration();
+  if (params_->has_low_interference() && !monitoring_modules_.empty()) {
+    module_stagger = polling_interval / monitoring_modules_.size();
+    for (std::unique_ptr<ErrorMonitorModuleInterface>& module :
+         monitoring_modules_) {
+      module->SetPollWindow(module_stagger, [this](absl::Time deadline) {
+        WaitUntil(deadline);
+        return !signal_stop_.HasBeenNotified();
+      });
     }
+  }
+
+  const absl::Time wall_start = absl::Now();
+  const absl::Duration cpu_start = ProcessCpuTime();
+  // Polls no later than `end_time`, so that a replay ends on its last
+  // snapshot.
+  while (!signal_stop_.HasBeenNotified() &&
+         previous_polling + polling_interval <= end_time) {
+    absl::Time start = previous_polling + polling_interval;
+    // Wait even without modules, so that the loop never spins.
+    WaitUntil(start);
     test_run_->LogDebug("Polling monitors");
-    for (auto& module : monitoring_modules_) {
-      RETURN_IF_ERROR(module->Poll(previous_polling, start));
+    for (size_t i = 0; i < monitoring_modules_.size(); ++i) {
+      absl::Duration offset = module_stagger * i;
+      if (i > 0) WaitUntil(start + offset);
+      RETURN_IF_ERROR(monitoring_modules_[i]->Poll(previous_polling + offset,
+                                                   start + offset));
     }
     previous_polling = start;
+    last_poll_time_ = start;
+    ++poll_count_;
+    PublishSnapshot();
+    if (failure_seen_ && params_->stop_on_failure()) {
+      test_run_->LogInfo("Stopping monitoring after the first failure.");
+      break;
+    }
   }
+  snapshot_server_.reset();
   RETURN_IF_ERROR(StopMonitoring());
+
+  if (params_->has_low_interference() && poll_count_ > 0) {
+    absl::Duration cpu = ProcessCpuTime() - cpu_start;
+    test_run_->LogInfo(absl::StrFormat(
+        "Monitoring used %s of CPU over %d polls (%s per poll).",
+        absl::FormatDuration(cpu), poll_count_,
+        absl::FormatDuration(cpu / poll_count_)));
+  }
+
+  if (replay_ != nullptr) {
+    absl::Duration elapsed = absl::Now() - wall_start;
+    test_run_->LogInfo(absl::StrFormat(
+        "Replayed %d snapshots as %d polls in %s (%.1f polls/sec).",
+        replay_->size(), poll_count_, absl::FormatDuration(elapsed),
+        poll_count_ / std::max(absl::ToDoubleSeconds(elapsed), 1e-9)));
+  }
   return absl::OkStatus();
 }
 
+void ErrorMonitor::WaitUntil(absl::Time deadline) {
+  while (!signal_stop_.HasBeenNotified() && clock_->Now() < deadline) {
+    clock_->SleepFor(
+        std::min(absl::Milliseconds(100), deadline - clock_->Now()));
+  }
+}
+
+MonitorSnapshot ErrorMonitor::Snapshot() const {
+  MonitorSnapshot snapshot;
+  snapshot.mutable_timestamp()->set_seconds(
+      absl::ToUnixSeconds(last_poll_time_));
+  snapshot.set_poll_count(poll_count_);
+  for (const std::unique_ptr<ErrorMonitorModuleInterface>& module :
+       monitoring_modules_) {
+    module->FillSnapshot(snapshot);
+  }
+  return snapshot;
+}
+
+void ErrorMonitor::PublishSnapshot() {
+  if (snapshot_server_ == nullptr) {
+    return;
+  }
+  snapshot_server_->Publish(Snapshot());
+}
+
 absl::Status ErrorMonitor::LoadHwInfos() {
   for (std::unique_ptr<ErrorMonitorModuleInterface>& module :
        monitoring_modules_) {
@@ -160,6 +364,14 @@ absl::Status ErrorMonitor::StartMonitoring() {
   test_run_->LogInfo("Starting error monitoring.");
   for (std::unique_ptr<ErrorMonitorModuleInterface>& module :
        monitoring_modules_) {
+    // `this` no longer moves once monitoring has started.
+    module->SetFailureCallback(
+        [this](absl::string_view symptom, absl::string_view message) {
+          failure_seen_ = true;
+          if (failure_callback_) {
+            failure_callback_(symptom, message);
+          }
+        });
     RETURN_IF_ERROR(module->StartMonitoring());
   }
   return absl::OkStatus();
@@ -16,13 +16,22 @@
 #define OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_ERROR_MONITOR_H_
 
 #include <atomic>
+#include <cstdint>
+#include <memory>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
 #include "ocpdiag/core/results/results.h"
 #include "lib/host_info/host_info.h"
+#include "error_monitor/clock.h"
+#include "error_monitor/counter_history.h"
 #include "error_monitor/error_monitor_module.h"
 #include "error_monitor/params.pb.h"
+#include "error_monitor/readout_source.h"
+#include "error_monitor/replay.h"
+#include "error_monitor/snapshot_server.h"
 
 namespace ocpdiag::error_monitor {
 
@@ -51,24 +60,52 @@ class ErrorMonitor {
   explicit ErrorMonitor(
       results::ResultApi& api, std::unique_ptr<results::TestRun> test_run,
       std::unique_ptr<Params> params,
-      SignalNotification& signal_stop)
+      SignalNotification& signal_stop,
+      std::unique_ptr<Clock> clock = std::make_unique<RealClock>())
       : result_api_(api),
         test_run_(std::move(test_run)),
         params_(std::move(params)),
+        clock_(std::move(clock)),
+        readout_(std::make_unique<LiveReadoutSource>()),
+        history_(std::make_unique<CounterHistory>(
+            int64_t{params_->history_budget_kib()} * 1024)),
         dut_info_(ocpdiag::GetHostnameOnDut()),
         signal_stop_(signal_stop) {}
 
   // Creates an ErrorMonitor.
   // Stop monitor immediately when `signal_stop` has been notified.
+  // If `replay_path` is set in params, the monitor replays the capture on a
+  // simulated clock instead of reading from the hardware.
   static absl::StatusOr<ErrorMonitor> Create(
       results::ResultApi& api, std::unique_ptr<results::TestRun> test_run,
       SignalNotification& signal_stop);
 
+  // Creates an ErrorMonitor with the given `params`, which are validated and
+  // defaulted here. If `replay` is non-null the monitor replays it on a
+  // simulated clock, and `replay_path` is ignored.
+  static absl::StatusOr<ErrorMonitor> Create(
+      results::ResultApi& api, std::unique_ptr<results::TestRun> test_run,
+      std::unique_ptr<Params> params, std::unique_ptr<ReplayCapture> replay,
+      SignalNotification& signal_stop);
+
   // The entry point for the diagnostic test.
   void ExecuteTest();
 
   void AddModule(std::unique_ptr<ErrorMonitorModuleInterface>&& module);
 
+  // Invokes `callback` from the polling loop for every FAIL diagnosis, as soon
+  // as a module emits it.
+  void SetFailureCallback(FailureCallback callback) {
+    failure_callback_ = std::move(callback);
+  }
+
+  // State of all modules as of the latest poll, as served on the snapshot
+  // socket.
+  MonitorSnapshot Snapshot() const;
+
+  // Time source of the polling loop. Simulated when replaying.
+  Clock& clock() { return *clock_; }
+
   ErrorMonitor(ErrorMonitor&&) = default;
   ErrorMonitor(const ErrorMonitor&) = delete;
   ErrorMonitor& operator=(const ErrorMonitor&) = delete;
@@ -83,15 +120,38 @@ class ErrorMonitor {
   absl::Status StartMonitoring();
   // Stops the monitoring, and reports diagnosis.
   absl::Status StopMonitoring();
+  // Sleeps until `deadline` or until `signal_stop_` is notified.
+  void WaitUntil(absl::Time deadline);
+  // Publishes Snapshot() to the snapshot socket, if enabled.
+  void PublishSnapshot();
 
   results::ResultApi& result_api_;
   std::unique_ptr<results::TestRun> test_run_;
   std::unique_ptr<Params> params_;
 
+  // Time source for the polling loop. Simulated when replaying.
+  std::unique_ptr<Clock> clock_;
+  // Recorded capture to replay, or null when monitoring live hardware.
+  std::unique_ptr<ReplayCapture> replay_;
+  // Where modules read counters from. Reads `replay_` when it is set.
+  std::unique_ptr<ReadoutSource> readout_;
+  // Counter history shared by all modules within `history_budget_kib`.
+  std::unique_ptr<CounterHistory> history_;
+  // Snapshot socket, or null when not requested.
+  std::unique_ptr<SnapshotServer> snapshot_server_;
+
   // Steps.
   //
   std::vector<std::unique_ptr<ErrorMonitorModuleInterface>> monitoring_modules_;
 
+  // Called for each FAIL diagnosis emitted by a module.
+  FailureCallback failure_callback_;
+  // Whether any module has emitted a FAIL diagnosis.
+  bool failure_seen_ = false;
+  // Time and number of the latest poll.
+  absl::Time last_poll_time_;
+  int poll_count_ = 0;
+
   // Hardware information.
   results::DutInfo dut_info_;
 
@@ -108,6 +168,12 @@ inline constexpr int kPollingIntervalSecsDefault = 300;
 inline constexpr int kMaxCeccPerDayDefault = 4000;
 // The default value of uecc_threshold.max_count_per_day in params.
 inline constexpr int kMaxUeccPerDayDefault = 0;
+// The default value of history_budget_kib in params.
+inline constexpr int kHistoryBudgetKibDefault = 4096;
+// The default value of anomaly_detection.ewma_alpha in params.
+inline constexpr double kEwmaAlphaDefault = 0.2;
+// The default value of anomaly_detection.cusum_slack_per_hour in params.
+inline constexpr double kCusumSlackPerHourDefault = 1;
 
 // Validates `params` and sets value to default if value is not set.
 // Checks dimm_name_map is not empty if `require_dimm_name_map` is true.
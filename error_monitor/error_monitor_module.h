@@ -15,12 +15,24 @@
 #ifndef OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_ERROR_MONITOR_MODULE_H_
 #define OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_ERROR_MONITOR_MODULE_H_
 
+#include <functional>
+
 #include "absl/status/status.h"
+#include "absl/strings/string_view.h"
 #include "absl/time/time.h"
 #include "ocpdiag/core/results/results.h"
+#include "error_monitor/snapshot.pb.h"
 
 namespace ocpdiag::error_monitor {
 
+// Called by a module each time it emits a FAIL diagnosis while polling.
+using FailureCallback =
+    std::function<void(absl::string_view symptom, absl::string_view message)>;
+
+// Waits until `deadline`. Returns false, possibly early, if monitoring is
+// stopping.
+using WaitUntilFunction = std::function<bool(absl::Time deadline)>;
+
 // Abstract interface for an error monitoring module. Each module tracks
 // a different class of errors.
 class ErrorMonitorModuleInterface {
@@ -32,10 +44,22 @@ class ErrorMonitorModuleInterface {
   // First time monitoring setup.
   virtual absl::Status StartMonitoring() = 0;
   // Poll for errors. Note that not all monitors need to make use of the
-  // timing parameters.
+  // timing parameters. FAIL diagnoses are emitted here, as soon as a
+  // threshold is crossed.
   virtual absl::Status Poll(const absl::Time start, const absl::Time end) = 0;
-  // Monitoring shutdown and diagnosis emission.
+  // Monitoring shutdown. Emits diagnoses for hardware that has not failed
+  // and closes any open steps.
   virtual absl::Status StopMonitoring() = 0;
+  // Appends the latest counters and current diagnoses to `snapshot`. Called
+  // from the polling thread after each poll.
+  virtual void FillSnapshot(MonitorSnapshot& snapshot) const {}
+  // Registers `callback` to run on every FAIL diagnosis emitted by Poll().
+  virtual void SetFailureCallback(FailureCallback callback) {}
+  // In low-interference mode, lets Poll() spread its work over `window` from
+  // when it is called, waiting between parts with `wait_until`. Modules whose
+  // poll cannot be split ignore it.
+  virtual void SetPollWindow(absl::Duration window,
+                             WaitUntilFunction wait_until) {}
 };
 
 }  // namespace ocpdiag::error_monitor
@@ -0,0 +1,211 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/error_monitor.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.h"
+#include "error_monitor/error_monitor_module.h"
+#include "error_monitor/params.pb.h"
+#include "error_monitor/replay.h"
+#include "error_monitor/snapshot.pb.h"
+#include "error_monitor/snapshot_server.h"
+
+namespace ocpdiag::error_monitor {
+namespace {
+
+using ::testing::HasSubstr;
+using ::testing::SizeIs;
+
+constexpr char kCapturePath[] = "error_monitor/testdata/replay_capture.jsonl";
+
+struct Failure {
+  std::string symptom;
+  std::string message;
+  // Since the start of the capture.
+  absl::Duration time;
+};
+
+// Runs the monitor over the sample capture, which records every 6 hours for
+// 2 days:
+//  - one PCIe endpoint whose correctable BadTLP count goes from 0 to 2 at the
+//    30 hour mark;
+//  - the EDAC CE counts of two memory controllers. mc0 gains 8 errors each
+//    day; mc1 is quiet for the first day and gains 11 in the second half of
+//    the second.
+class ErrorMonitorReplayTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    params_ = std::make_unique<Params>();
+    params_->set_polling_interval_secs(6 * 60 * 60);
+    params_->set_history_budget_kib(64);
+    source_ = params_->add_sysfs_counters();
+    source_->set_name("edac");
+    source_->add_globs("/sys/devices/system/edac/mc/mc*/ce_count");
+    source_->set_format(SysfsCounterSource::VALUE);
+    source_->mutable_threshold()->set_max_count_per_day(10);
+  }
+
+  // Replays the capture to its end with `params_`.
+  void RunToEnd() {
+    absl::StatusOr<std::unique_ptr<ReplayCapture>> capture =
+        ReplayCapture::Load(kCapturePath);
+    ASSERT_TRUE(capture.ok()) << capture.status();
+    const absl::Time start = (*capture)->start_time();
+    absl::StatusOr<std::unique_ptr<results::TestRun>> test_run =
+        api_.InitializeTestRun("error-monitor-replay-test");
+    ASSERT_TRUE(test_run.ok()) << test_run.status();
+
+    absl::StatusOr<ErrorMonitor> monitor =
+        ErrorMonitor::Create(api_, *std::move(test_run), std::move(params_),
+                             *std::move(capture), signal_stop_);
+    ASSERT_TRUE(monitor.ok()) << monitor.status();
+    monitor->SetFailureCallback(
+        [&](absl::string_view symptom, absl::string_view message) {
+          failures_.push_back({std::string(symptom), std::string(message),
+                               monitor->clock().Now() - start});
+        });
+    monitor->ExecuteTest();
+    snapshot_ = monitor->Snapshot();
+  }
+
+  std::unique_ptr<Params> params_;
+  SysfsCounterSource* source_;
+  results::ResultApi api_;
+  SignalNotification signal_stop_;
+  std::vector<Failure> failures_;
+  MonitorSnapshot snapshot_;
+};
+
+TEST_F(ErrorMonitorReplayTest, FailsInPollThatSeesFirstError) {
+  RunToEnd();
+
+  // One poll per snapshot, none past the end of the capture.
+  EXPECT_EQ(snapshot_.poll_count(), 9);
+  // mc0 gains 16 errors over the capture but never more than 10 in a day.
+  ASSERT_THAT(failures_, SizeIs(2));
+  EXPECT_EQ(failures_[0].symptom, "unhealthy-pcie-link");
+  EXPECT_THAT(failures_[0].message, HasSubstr("correctable:BadTLP"));
+  EXPECT_EQ(failures_[0].time, absl::Hours(30));
+  EXPECT_EQ(failures_[1].symptom, "excessive-edac-errors");
+  EXPECT_THAT(failures_[1].message, HasSubstr("mc1"));
+  EXPECT_EQ(failures_[1].time, absl::Hours(42));
+}
+
+TEST_F(ErrorMonitorReplayTest, FailsOncePerCounter) {
+  params_->add_monitors(SYSFS_COUNTER_MONITOR);
+  source_->mutable_threshold()->set_max_count_per_day(1);
+  RunToEnd();
+
+  ASSERT_THAT(failures_, SizeIs(2));
+  EXPECT_EQ(failures_[0].symptom, "excessive-edac-errors");
+  EXPECT_THAT(failures_[0].message, HasSubstr("mc0"));
+  EXPECT_EQ(failures_[0].time, absl::Hours(6));
+  EXPECT_THAT(failures_[1].message, HasSubstr("mc1"));
+  EXPECT_EQ(failures_[1].time, absl::Hours(36));
+}
+
+TEST_F(ErrorMonitorReplayTest, AnomalyAlarmFailsHardware) {
+  // The per-day threshold never trips; mc1's 5 errors in 6 hours at 36h take
+  // its rate over 0.5/hour while mc0 stays at 1/3 per hour.
+  params_->add_monitors(SYSFS_COUNTER_MONITOR);
+  source_->mutable_threshold()->set_max_count_per_day(1000);
+  params_->mutable_anomaly_detection()->set_ewma_alpha(1);
+  params_->mutable_anomaly_detection()->set_ewma_rate_per_hour(0.5);
+  RunToEnd();
+
+  ASSERT_THAT(failures_, SizeIs(1));
+  EXPECT_EQ(failures_[0].symptom, "high-edac-error-rate");
+  EXPECT_EQ(failures_[0].time, absl::Hours(36));
+
+  // The alarm leaves mc1 failed rather than passing at the end.
+  ASSERT_THAT(snapshot_.diagnoses(), SizeIs(2));
+  EXPECT_EQ(snapshot_.diagnoses(0).hardware(), "mc0");
+  EXPECT_EQ(snapshot_.diagnoses(0).type(), "PASS");
+  EXPECT_EQ(snapshot_.diagnoses(1).hardware(), "mc1");
+  EXPECT_EQ(snapshot_.diagnoses(1).type(), "FAIL");
+  EXPECT_EQ(snapshot_.diagnoses(1).symptom(), "high-edac-error-rate");
+  EXPECT_THAT(snapshot_.diagnoses(1).message(),
+              HasSubstr("ce_count (high rate)"));
+}
+
+// Records which phases the monitor ran it through.
+class RecordingModule : public ErrorMonitorModuleInterface {
+ public:
+  explicit RecordingModule(std::vector<std::string>& calls) : calls_(calls) {}
+
+  absl::Status LoadHwInfos(results::DutInfo& dut_info) final {
+    calls_.push_back("LoadHwInfos");
+    return absl::OkStatus();
+  }
+  absl::Status StartMonitoring() final {
+    calls_.push_back("StartMonitoring");
+    return absl::OkStatus();
+  }
+  absl::Status Poll(const absl::Time start, const absl::Time end) final {
+    calls_.push_back("Poll");
+    return absl::OkStatus();
+  }
+  absl::Status StopMonitoring() final {
+    calls_.push_back("StopMonitoring");
+    return absl::OkStatus();
+  }
+
+ private:
+  std::vector<std::string>& calls_;
+};
+
+TEST(ErrorMonitorTest, SnapshotSocketErrorStartsNoModule) {
+  const std::string path =
+      absl::StrCat(::testing::TempDir(), "/error_monitor_test.sock");
+  // A live server holds the socket, so the monitor cannot bind it.
+  absl::StatusOr<std::unique_ptr<SnapshotServer>> other =
+      SnapshotServer::Start(path);
+  ASSERT_TRUE(other.ok()) << other.status();
+
+  absl::StatusOr<std::unique_ptr<ReplayCapture>> capture =
+      ReplayCapture::Load(kCapturePath);
+  ASSERT_TRUE(capture.ok()) << capture.status();
+  results::ResultApi api;
+  absl::StatusOr<std::unique_ptr<results::TestRun>> test_run =
+      api.InitializeTestRun("error-monitor-test");
+  ASSERT_TRUE(test_run.ok()) << test_run.status();
+  auto params = std::make_unique<Params>();
+  params->set_snapshot_socket_path(path);
+  // No module of its own: there are no sysfs sources.
+  params->add_monitors(SYSFS_COUNTER_MONITOR);
+  SignalNotification signal_stop;
+  absl::StatusOr<ErrorMonitor> monitor =
+      ErrorMonitor::Create(api, *std::move(test_run), std::move(params),
+                           *std::move(capture), signal_stop);
+  ASSERT_TRUE(monitor.ok()) << monitor.status();
+  std::vector<std::string> calls;
+  monitor->AddModule(std::make_unique<RecordingModule>(calls));
+
+  monitor->ExecuteTest();
+  EXPECT_EQ(calls, std::vector<std::string>{"LoadHwInfos"});
+}
+
+}  // namespace
+}  // namespace ocpdiag::error_monitor
@@ -0,0 +1,83 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/low_interference.h"
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::error_monitor {
+
+namespace {
+
+// From linux/ioprio.h, which glibc does not wrap.
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioClassIdle = 3;
+constexpr int kIoprioClassShift = 13;
+
+absl::Status ErrnoError(absl::string_view what) {
+  return absl::InternalError(absl::StrFormat("%s: %s", what, strerror(errno)));
+}
+
+absl::Duration ToDuration(const timeval& tv) {
+  return absl::Seconds(tv.tv_sec) + absl::Microseconds(tv.tv_usec);
+}
+
+}  // namespace
+
+absl::Status EnterLowInterferenceMode(const LowInterference& options) {
+  if (!options.housekeeping_cpus().empty()) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : options.housekeeping_cpus()) {
+      CPU_SET(cpu, &cpus);
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+      return ErrnoError("unable to pin to housekeeping cpus");
+    }
+  }
+
+  sched_param param = {};
+  if (sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+    return ErrnoError("unable to switch to SCHED_IDLE");
+  }
+
+  if (syscall(SYS_ioprio_set, kIoprioWhoProcess, 0,
+              kIoprioClassIdle << kIoprioClassShift) != 0) {
+    return ErrnoError("unable to set idle io priority");
+  }
+  return absl::OkStatus();
+}
+
+absl::Duration ProcessCpuTime() {
+  absl::Duration total;
+  for (int who : {RUSAGE_SELF, RUSAGE_CHILDREN}) {
+    rusage usage;
+    if (getrusage(who, &usage) == 0) {
+      total += ToDuration(usage.ru_utime) + ToDuration(usage.ru_stime);
+    }
+  }
+  return total;
+}
+
+}  // namespace ocpdiag::error_monitor
@@ -0,0 +1,35 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_LOW_INTERFERENCE_H_
+#define OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_LOW_INTERFERENCE_H_
+
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "error_monitor/params.pb.h"
+
+namespace ocpdiag::error_monitor {
+
+// Moves the calling thread to SCHED_IDLE with idle I/O priority, and pins it
+// to `options.housekeeping_cpus` if any are given. Threads and subprocesses
+// started afterwards inherit all three, so this should be called before any
+// are started.
+absl::Status EnterLowInterferenceMode(const LowInterference& options);
+
+// CPU time used by this process and its reaped subprocesses so far.
+absl::Duration ProcessCpuTime();
+
+}  // namespace ocpdiag::error_monitor
+
+#endif  // OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_LOW_INTERFERENCE_H_
@@ -0,0 +1,197 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the tail latency a polling monitor adds to a latency-sensitive
+// workload on the same CPU, with and without low-interference mode.
+//
+// The workload serves a request every millisecond: it sleeps until the
+// request is due, then spins for a fixed amount of work. Its latency is the
+// time from the due time to the end of the work. The monitor polls every
+// 50 ms with a SysfsCounterReader over a fake tree of AER files in a
+// temporary directory, the read path of a sysfs source. In low-interference
+// mode it reads the files in slices spread over the interval, as the sysfs
+// module does, and otherwise in one burst. Both threads are pinned to the
+// same CPU so that they compete for it.
+
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "error_monitor/low_interference.h"
+#include "error_monitor/params.pb.h"
+#include "error_monitor/readout_source.h"
+#include "error_monitor/sysfs_counters/sysfs_counter_step.h"
+
+namespace ocpdiag::error_monitor {
+namespace {
+
+constexpr absl::Duration kRunTime = absl::Seconds(5);
+constexpr absl::Duration kRequestInterval = absl::Milliseconds(1);
+constexpr absl::Duration kRequestWork = absl::Microseconds(100);
+constexpr absl::Duration kPollInterval = absl::Milliseconds(50);
+// Stays under the default limit of 1024 open files.
+constexpr int kFiles = 768;
+
+struct Percentiles {
+  absl::Duration p50, p99, p999, max;
+};
+
+void PinToCpu(int cpu) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  sched_setaffinity(0, sizeof(cpus), &cpus);
+}
+
+void SleepUntil(absl::Time deadline) {
+  timespec ts = absl::ToTimespec(deadline);
+  while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, nullptr) != 0) {
+  }
+}
+
+void Spin(absl::Duration work) {
+  const absl::Time end = absl::Now() + work;
+  while (absl::Now() < end) {
+  }
+}
+
+Percentiles Workload(int cpu) {
+  PinToCpu(cpu);
+  std::vector<absl::Duration> latencies;
+  const absl::Time end = absl::Now() + kRunTime;
+  for (absl::Time due = absl::Now() + kRequestInterval; due < end;
+       due += kRequestInterval) {
+    SleepUntil(due);
+    Spin(kRequestWork);
+    latencies.push_back(absl::Now() - due);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto at = [&](double q) {
+    return latencies[static_cast<size_t>(q * (latencies.size() - 1))];
+  };
+  return {at(0.5), at(0.99), at(0.999), latencies.back()};
+}
+
+// Writes `kFiles` AER files under `root` and returns their paths.
+std::vector<std::string> BuildTree(const std::filesystem::path& root) {
+  std::filesystem::remove_all(root);
+  std::vector<std::string> paths;
+  for (int i = 0; i < kFiles; ++i) {
+    const std::filesystem::path dir = root / absl::StrCat("dev", i);
+    std::filesystem::create_directories(dir);
+    std::ofstream(dir / "aer_dev_correctable")
+        << "RxErr 0\nBadTLP 3\nBadDLLP 0\nRollover 0\nTimeout 1\n";
+    paths.push_back((dir / "aer_dev_correctable").string());
+  }
+  return paths;
+}
+
+void Monitor(int cpu, bool low_interference,
+             const std::vector<std::string>& paths, std::atomic<bool>& stop) {
+  PinToCpu(cpu);
+  if (low_interference) {
+    if (absl::Status status = EnterLowInterferenceMode(LowInterference());
+        !status.ok()) {
+      std::fprintf(stderr, "%s\n", status.ToString().c_str());
+    }
+  }
+  LiveReadoutSource readout;
+  SysfsCounterReader reader(readout);
+  for (const std::string& path : paths) {
+    if (absl::StatusOr<const SysfsCounterFile*> file =
+            reader.AddFile(path, SysfsCounterSource::KEY_VALUE);
+        !file.ok()) {
+      std::fprintf(stderr, "%s\n", file.status().ToString().c_str());
+      return;
+    }
+  }
+  reader.Shard(false);
+  const int slices =
+      low_interference
+          ? (kFiles + internal::kFilesPerReadSlice - 1) /
+                internal::kFilesPerReadSlice
+          : 1;
+  for (absl::Time next = absl::Now(); !stop.load(); next += kPollInterval) {
+    for (int slice = 0; slice < slices; ++slice) {
+      SleepUntil(next + kPollInterval * slice / slices);
+      if (absl::Status status = reader.Read(slice, slices); !status.ok()) {
+        std::fprintf(stderr, "%s\n", status.ToString().c_str());
+        return;
+      }
+    }
+  }
+}
+
+Percentiles Run(int cpu, std::optional<bool> low_interference,
+                const std::vector<std::string>& paths) {
+  std::atomic<bool> stop = false;
+  std::thread monitor;
+  if (low_interference.has_value()) {
+    monitor = std::thread(Monitor, cpu, *low_interference, std::cref(paths),
+                          std::ref(stop));
+  }
+  Percentiles result = Workload(cpu);
+  stop.store(true);
+  if (monitor.joinable()) monitor.join();
+  return result;
+}
+
+void Print(const char* name, const Percentiles& p, const Percentiles& base) {
+  auto us = [](absl::Duration d) { return absl::ToDoubleMicroseconds(d); };
+  std::printf(
+      "%-26s p50 %8.1f  p99 %8.1f  p99.9 %8.1f  max %8.1f us  "
+      "(%+.1f us at p99, %+.1f us at p99.9)\n",
+      name, us(p.p50), us(p.p99), us(p.p999), us(p.max),
+      us(p.p99 - base.p99), us(p.p999 - base.p999));
+}
+
+}  // namespace
+}  // namespace ocpdiag::error_monitor
+
+int main() {
+  using ::ocpdiag::error_monitor::Print;
+  using ::ocpdiag::error_monitor::Run;
+  const std::filesystem::path root =
+      std::filesystem::temp_directory_path() /
+      absl::StrCat("low_interference_benchmark.", getpid());
+  const std::vector<std::string> paths =
+      ::ocpdiag::error_monitor::BuildTree(root);
+  std::printf("%d KEY_VALUE files read every %s\n",
+              ::ocpdiag::error_monitor::kFiles,
+              absl::FormatDuration(::ocpdiag::error_monitor::kPollInterval)
+                  .c_str());
+  const int cpu = sched_getcpu();
+  const auto base = Run(cpu, std::nullopt, paths);
+  Print("no monitor", base, base);
+  Print("monitor", Run(cpu, false, paths), base);
+  Print("monitor, low interference", Run(cpu, true, paths), base);
+  std::filesystem::remove_all(root);
+  return 0;
+}
@@ -14,9 +14,8 @@
 
 #include "error_monitor/pcie_errors/pcie_error_step.h"
 
-#include <filesystem>
+#include <optional>
 
-#include "google/protobuf/util/json_util.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -25,7 +24,6 @@
 #include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
-#include "ocpdiag/core/compat/status_converters.h"
 #include "ocpdiag/core/compat/status_macros.h"
 #include "ocpdiag/core/results/results.h"
 #include "ocpdiag/core/results/results.pb.h"
@@ -74,38 +72,7 @@ absl::StatusOr<PciCrawlerReadout> PcieErrorMonitorModule::ExecutePciCrawler() {
       absl::StrSplit(PciCrawlerExecutableLocation(), ' ');
   std::vector<std::string> params = PciCrawlerExecutableArguments();
   args.insert(args.end(), params.begin(), params.end());
-
-  if (!std::filesystem::exists(args[0])) {
-    return absl::FailedPreconditionError(
-        absl::StrFormat("unable to find pcicrawler exe at '%s'", args[0]));
-  }
-  FILE* pipe = popen(absl::StrJoin(args, " ").c_str(), "r");
-  if (!pipe) {
-    return absl::UnknownError("Failed to open pipe to pcicrawler subprocess");
-  }
-
-  std::array<char, 128> buffer;
-  std::string output;
-
-  while (!feof(pipe)) {
-    if (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-      output += buffer.data();
-    }
-  }
-  if (int rc = pclose(pipe); rc != 0) {
-    return absl::UnknownError(
-        absl::StrFormat("pcicrawler exited with nonzero rc: %d", rc));
-  }
-  google::protobuf::util::JsonParseOptions opts;
-  opts.ignore_unknown_fields = true;
-  ocpdiag::error_monitor::PciCrawlerReadout readings;
-  const std::string wrapped_input = absl::StrCat("{ pci_links:", output, "}");
-  if (absl::Status status = AsAbslStatus(
-          google::protobuf::util::JsonStringToMessage(wrapped_input, &readings, opts));
-      !status.ok()) {
-    return status;
-  }
-  return readings;
+  return readout_.ReadPciCrawler(args);
 }
 
 namespace {
@@ -149,6 +116,7 @@ absl::Status PcieErrorMonitorModule::LoadHwInfos(results::DutInfo& dut_info) {
 absl::Status PcieErrorMonitorModule::StartMonitoring() {
   ASSIGN_OR_RETURN(PciCrawlerReadout pci_info, ExecutePciCrawler());
 
+  int untracked = 0;
   for (auto& [addr, link] : links_) {
     ASSIGN_OR_RETURN(link.step,
                      result_api_.BeginTestStep(
@@ -171,14 +139,35 @@ absl::Status PcieErrorMonitorModule::StartMonitoring() {
       for (const auto& [error_type, unused] : category_readings) {
         measurement_info.set_name(
             absl::StrFormat("%s:%s", error_category, error_type));
-        std::unique_ptr<results::MeasurementSeries>& series =
-            link.measurements[error_category][error_type].series;
-        ASSIGN_OR_RETURN(series, result_api_.BeginMeasurementSeries(
-                                     link.step.get(), link.remote_hw_record,
-                                     measurement_info));
+        MeasurementHolder& holder =
+            link.measurements[error_category][error_type];
+        ASSIGN_OR_RETURN(holder.series, result_api_.BeginMeasurementSeries(
+                                            link.step.get(),
+                                            link.remote_hw_record,
+                                            measurement_info));
+        holder.history = history_.Track(
+            absl::StrFormat("%s/%s:%s", addr, error_category, error_type));
+        untracked += holder.history == nullptr;
+        holder.index = counter_names_.size();
+        counter_names_.emplace_back(
+            addr, absl::StrFormat("%s:%s", error_category, error_type));
       }
     }
   }
+
+  if (untracked > 0) {
+    test_run_.LogWarn(absl::StrFormat(
+        "Shared counter history budget of %d KiB holds %d of %d PCIe "
+        "counters; the rest have no history.",
+        params_.history_budget_kib(), counter_names_.size() - untracked,
+        counter_names_.size()));
+  }
+
+  counter_values_.resize(counter_names_.size());
+  if (params_.has_anomaly_detection()) {
+    anomaly_detector_ = std::make_unique<RateAnomalyDetector>(
+        params_.anomaly_detection(), counter_names_.size());
+  }
   return absl::OkStatus();
 }
 
@@ -192,6 +181,7 @@ absl::Status PcieErrorMonitorModule::Poll(const absl::Time start,
       return absl::UnknownError(
           absl::StrFormat("No readings for address %s", addr));
     }
+    const size_t previous_failures = link.failures.size();
     const AerSubcategoryReadings& aer_readings =
         crawler_link->second.aer().device();
 
@@ -207,46 +197,116 @@ absl::Status PcieErrorMonitorModule::Poll(const absl::Time start,
         google::protobuf::Value val;
         val.set_number_value(category_readings.at(reading_type));
         series.series->AddElement(val);
-        if (val.number_value() > 0) {
+        if (series.history != nullptr) {
+          series.history->Append(end, category_readings.at(reading_type));
+        }
+        counter_values_[series.index] = val.number_value();
+        if (val.number_value() > 0 && !series.errors_found) {
           series.errors_found = true;
+          link.failures.push_back(
+              absl::StrFormat("%s:%s", error_category, reading_type));
         }
       }
     }
+
+    if (link.failures.size() > previous_failures) {
+      ReportFailure(
+          link, "unhealthy-pcie-link",
+          absl::StrFormat(
+              "AER errors found for link with endpoint %s, with type(s): %s",
+              addr,
+              absl::StrJoin(link.failures.begin() + previous_failures,
+                            link.failures.end(), ",")));
+    }
+  }
+
+  if (anomaly_detector_ != nullptr) {
+    for (const RateAnomalyDetector::Alarm& alarm :
+         anomaly_detector_->Update(counter_values_, end - start)) {
+      const auto& [addr, error_type] = counter_names_[alarm.index];
+      bool ewma = alarm.kind == RateAnomalyDetector::kEwmaRate;
+      ReportFailure(
+          links_[addr],
+          ewma ? "high-pcie-error-rate" : "accelerating-pcie-errors",
+          absl::StrFormat("%s AER errors %s for link with endpoint %s, "
+                          "at %.2f errors/hour",
+                          error_type,
+                          ewma ? "above rate threshold" : "accelerating", addr,
+                          alarm.rate_per_hour));
+    }
   }
 
   return absl::OkStatus();
 }
+
+void PcieErrorMonitorModule::ReportFailure(PciLinkTracker& link,
+                                           absl::string_view symptom,
+                                           absl::string_view message) {
+  link.step->AddDiagnosis(rpb::Diagnosis_Type::Diagnosis_Type_FAIL,
+                          std::string(symptom), std::string(message),
+                          {link.local_hw_record, link.remote_hw_record});
+  if (on_failure_) {
+    on_failure_(symptom, message);
+  }
+}
+
 absl::Status PcieErrorMonitorModule::StopMonitoring() {
   for (auto& [addr, link] : links_) {
-    std::vector<std::string> failures;
     for (auto& [category, trackers] : link.measurements) {
       for (auto& [error_type, series] : trackers) {
-        if (series.errors_found) {
-          failures.push_back(absl::StrFormat("%s:%s", category, error_type));
+        if (series.errors_found && series.history != nullptr) {
+          if (std::optional<absl::Time> first = series.history->FirstIncrease();
+              first.has_value()) {
+            link.step->LogInfo(absl::StrFormat(
+                "%s:%s first increased at %s, %.2f/hour since", category,
+                error_type, absl::FormatTime(*first),
+                series.history->RatePerSecond(*first) * 3600));
+          }
         }
         series.series->End();
       }
     }
 
-    std::vector<results::HwRecord> records = {link.local_hw_record,
-                                              link.remote_hw_record};
-    if (failures.empty()) {
+    // Failing links were diagnosed as they failed.
+    if (link.failures.empty()) {
       link.step->AddDiagnosis(
           rpb::Diagnosis_Type::Diagnosis_Type_PASS, "healthy-pcie-link",
           absl::StrFormat("No AER errors found for link with endpoint %s",
                           addr),
-          records);
-    } else {
-      link.step->AddDiagnosis(
-          rpb::Diagnosis_Type::Diagnosis_Type_FAIL, "unhealthy-pcie-link",
-          absl::StrFormat(
-              "AER errors found for link with endpoint %s, with type(s): %s",
-              addr, absl::StrJoin(failures, ",")),
-          records);
+          {link.local_hw_record, link.remote_hw_record});
     }
     link.step->End();
   }
   return absl::OkStatus();
 }
 
+void PcieErrorMonitorModule::FillSnapshot(MonitorSnapshot& snapshot) const {
+  for (const auto& [addr, link] : links_) {
+    for (const auto& [category, trackers] : link.measurements) {
+      for (const auto& [error_type, series] : trackers) {
+        if (series.index < 0) continue;
+        CounterSnapshot* counter = snapshot.add_counters();
+        counter->set_name(
+            absl::StrFormat("%s/%s:%s", addr, category, error_type));
+        counter->set_value(counter_values_[series.index]);
+      }
+    }
+
+    DiagnosisSnapshot* diagnosis = snapshot.add_diagnoses();
+    diagnosis->set_hardware(addr);
+    if (link.failures.empty()) {
+      diagnosis->set_symptom("healthy-pcie-link");
+      diagnosis->set_type("PASS");
+      diagnosis->set_message(absl::StrFormat(
+          "No AER errors found for link with endpoint %s", addr));
+    } else {
+      diagnosis->set_symptom("unhealthy-pcie-link");
+      diagnosis->set_type("FAIL");
+      diagnosis->set_message(absl::StrFormat(
+          "AER errors found for link with endpoint %s, with type(s): %s", addr,
+          absl::StrJoin(link.failures, ",")));
+    }
+  }
+}
+
 }  // namespace ocpdiag::error_monitor
@@ -19,8 +19,11 @@
 #include "absl/status/statusor.h"
 #include "ocpdiag/core/results/results.h"
 #include "ocpdiag/core/results/results.pb.h"
+#include "error_monitor/anomaly_detector.h"
+#include "error_monitor/counter_history.h"
 #include "error_monitor/error_monitor_module.h"
 #include "error_monitor/params.pb.h"
+#include "error_monitor/readout_source.h"
 #include "error_monitor/pcie_errors/pcicrawler.pb.h"
 
 namespace ocpdiag::error_monitor {
@@ -30,6 +33,11 @@ struct MeasurementHolder {
   std::unique_ptr<results::MeasurementSeries> series = nullptr;
   // True if a nonzero error count is registered.
   bool errors_found = false;
+  // Compressed history of the count, owned by the module's CounterHistory.
+  // Null if the history budget cannot hold it.
+  CounterSeries* history = nullptr;
+  // Position of the count in the module's packed per-counter arrays.
+  int index = -1;
 };
 
 struct PciLinkTracker {
@@ -41,25 +49,37 @@ struct PciLinkTracker {
   std::unique_ptr<results::TestStep> step;
   results::HwRecord local_hw_record;
   results::HwRecord remote_hw_record;
+  // Error types that have crossed their threshold, as "{category}:{type}".
   std::vector<std::string> failures;
 };
 
 class PcieErrorMonitorModule : public ErrorMonitorModuleInterface {
  public:
   virtual ~PcieErrorMonitorModule() = default;
+  // pcicrawler readouts are taken from `readout`. Counter histories are kept
+  // in `history`, which may be shared with other modules.
   explicit PcieErrorMonitorModule(results::ResultApi& api,
                                   results::TestRun& test_run,
-                                  const Params& params)
+                                  const Params& params,
+                                  ReadoutSource& readout,
+                                  CounterHistory& history)
       : result_api_(api),
         test_run_(test_run),
-        params_(params) {}
+        params_(params),
+        readout_(readout),
+        history_(history) {}
 
   absl::Status LoadHwInfos(results::DutInfo& dut_info) final;
   absl::Status StartMonitoring() final;
   absl::Status Poll(const absl::Time start, const absl::Time end) final;
   absl::Status StopMonitoring() final;
+  void FillSnapshot(MonitorSnapshot& snapshot) const final;
+  void SetFailureCallback(FailureCallback callback) final {
+    on_failure_ = std::move(callback);
+  }
 
-  // Executes the PciCrawler tool, and attempts to parse the output.
+  // Executes the PciCrawler tool through the readout source, and attempts to
+  // parse the output.
   absl::StatusOr<PciCrawlerReadout> ExecutePciCrawler();
 
   // Returns the command string to be executed for pcicrawler.
@@ -69,12 +89,26 @@ class PcieErrorMonitorModule : public ErrorMonitorModuleInterface {
  private:
   // Arguments to send to PCI crawler
   std::vector<std::string> PciCrawlerExecutableArguments();
+  // Emits a FAIL diagnosis for `link` and notifies `on_failure_`.
+  void ReportFailure(PciLinkTracker& link, absl::string_view symptom,
+                     absl::string_view message);
 
   // Test-level data
   results::ResultApi& result_api_;
   results::TestRun& test_run_;
   const Params& params_;
+  ReadoutSource& readout_;
   absl::flat_hash_map<std::string, PciLinkTracker> links_;
+  // Counter history keyed by "{addr}/{category}:{error_type}", shared with
+  // the other modules.
+  CounterHistory& history_;
+  // Link address and "{category}:{error_type}" of each counter, and its
+  // latest value, indexed by MeasurementHolder::index.
+  std::vector<std::pair<std::string, std::string>> counter_names_;
+  std::vector<double> counter_values_;
+  // Null unless anomaly detection is configured.
+  std::unique_ptr<RateAnomalyDetector> anomaly_detector_;
+  FailureCallback on_failure_;
 };
 
 }  // namespace ocpdiag::error_monitor
@@ -0,0 +1,149 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/readout_source.h"
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/util/json_util.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "ocpdiag/core/compat/status_converters.h"
+
+namespace ocpdiag::error_monitor {
+
+absl::StatusOr<PciCrawlerReadout> LiveReadoutSource::ReadPciCrawler(
+    const std::vector<std::string>& command) {
+  if (command.empty() || !std::filesystem::exists(command[0])) {
+    return absl::FailedPreconditionError(absl::StrFormat(
+        "unable to find pcicrawler exe at '%s'",
+        command.empty() ? "" : command[0]));
+  }
+  FILE* pipe = popen(absl::StrJoin(command, " ").c_str(), "r");
+  if (!pipe) {
+    return absl::UnknownError("Failed to open pipe to pcicrawler subprocess");
+  }
+
+  std::array<char, 128> buffer;
+  std::string output;
+
+  while (!feof(pipe)) {
+    if (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
+      output += buffer.data();
+    }
+  }
+  if (int rc = pclose(pipe); rc != 0) {
+    return absl::UnknownError(
+        absl::StrFormat("pcicrawler exited with nonzero rc: %d", rc));
+  }
+  google::protobuf::util::JsonParseOptions opts;
+  opts.ignore_unknown_fields = true;
+  PciCrawlerReadout readings;
+  const std::string wrapped_input = absl::StrCat("{ pci_links:", output, "}");
+  if (absl::Status status = AsAbslStatus(
+          google::protobuf::util::JsonStringToMessage(wrapped_input, &readings, opts));
+      !status.ok()) {
+    return status;
+  }
+  return readings;
+}
+
+absl::StatusOr<std::vector<std::string>> LiveReadoutSource::Glob(
+    const std::string& pattern) {
+  std::vector<std::string> paths;
+  glob_t matches;
+  int rc = glob(pattern.c_str(), 0, nullptr, &matches);
+  if (rc == 0) {
+    paths.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+  }
+  globfree(&matches);
+  if (rc != 0 && rc != GLOB_NOMATCH) {
+    return absl::UnknownError(
+        absl::StrFormat("glob '%s' failed with rc %d", pattern, rc));
+  }
+  return paths;
+}
+
+absl::StatusOr<int> LiveReadoutSource::Open(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return absl::FailedPreconditionError(absl::StrFormat(
+        "Unable to open counter file %s: %s", path, strerror(errno)));
+  }
+  return fd;
+}
+
+absl::StatusOr<absl::string_view> LiveReadoutSource::Read(
+    int handle, absl::Span<char> buffer) {
+  ssize_t n = pread(handle, buffer.data(), buffer.size(), 0);
+  if (n < 0) {
+    return absl::UnknownError(strerror(errno));
+  }
+  return absl::string_view(buffer.data(), n);
+}
+
+void LiveReadoutSource::Close(int handle) { close(handle); }
+
+absl::StatusOr<PciCrawlerReadout> CaptureReadoutSource::ReadPciCrawler(
+    const std::vector<std::string>& command) {
+  return capture_.SnapshotAt(clock_.Now()).pcicrawler();
+}
+
+absl::StatusOr<std::vector<std::string>> CaptureReadoutSource::Glob(
+    const std::string& pattern) {
+  std::vector<std::string> paths;
+  for (const auto& [path, unused] :
+       capture_.SnapshotAt(clock_.Now()).sysfs_files()) {
+    if (fnmatch(pattern.c_str(), path.c_str(), FNM_PATHNAME) == 0) {
+      paths.push_back(path);
+    }
+  }
+  // Sorted, as glob(3) returns them.
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+absl::StatusOr<int> CaptureReadoutSource::Open(const std::string& path) {
+  paths_.push_back(path);
+  return paths_.size() - 1;
+}
+
+absl::StatusOr<absl::string_view> CaptureReadoutSource::Read(
+    int handle, absl::Span<char> buffer) {
+  const auto& files = capture_.SnapshotAt(clock_.Now()).sysfs_files();
+  auto it = files.find(paths_[handle]);
+  if (it == files.end()) {
+    return absl::NotFoundError("not in the capture snapshot");
+  }
+  return it->second;
+}
+
+}  // namespace ocpdiag::error_monitor
@@ -0,0 +1,93 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_READOUT_SOURCE_H_
+#define OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_READOUT_SOURCE_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "error_monitor/clock.h"
+#include "error_monitor/replay.h"
+#include "error_monitor/pcie_errors/pcicrawler.pb.h"
+
+namespace ocpdiag::error_monitor {
+
+// Where modules read hardware counters from: the live host, or a recorded
+// capture. Modules only talk to this interface, so a new module supports
+// replay without any replay-specific code.
+class ReadoutSource {
+ public:
+  virtual ~ReadoutSource() = default;
+
+  // Runs the pcicrawler invocation `command` and returns its parsed output.
+  virtual absl::StatusOr<PciCrawlerReadout> ReadPciCrawler(
+      const std::vector<std::string>& command) = 0;
+
+  // Returns the paths of the files matching the glob `pattern`, sorted.
+  virtual absl::StatusOr<std::vector<std::string>> Glob(
+      const std::string& pattern) = 0;
+  // Opens the file at `path` for repeated reads. Returns a handle for Read.
+  virtual absl::StatusOr<int> Open(const std::string& path) = 0;
+  // Returns the current contents of the file behind `handle`, read through
+  // `buffer`. The view is valid until `buffer` is reused. May be called
+  // concurrently with different buffers.
+  virtual absl::StatusOr<absl::string_view> Read(int handle,
+                                                 absl::Span<char> buffer) = 0;
+  virtual void Close(int handle) = 0;
+};
+
+// Reads from the running host: executes pcicrawler and reads sysfs.
+class LiveReadoutSource final : public ReadoutSource {
+ public:
+  absl::StatusOr<PciCrawlerReadout> ReadPciCrawler(
+      const std::vector<std::string>& command) final;
+  absl::StatusOr<std::vector<std::string>> Glob(
+      const std::string& pattern) final;
+  absl::StatusOr<int> Open(const std::string& path) final;
+  absl::StatusOr<absl::string_view> Read(int handle,
+                                         absl::Span<char> buffer) final;
+  void Close(int handle) final;
+};
+
+// Answers from the snapshot of `capture` current at `clock` time. The
+// pcicrawler command is ignored, and files are matched against the paths
+// recorded in the snapshot.
+class CaptureReadoutSource final : public ReadoutSource {
+ public:
+  CaptureReadoutSource(const ReplayCapture& capture, Clock& clock)
+      : capture_(capture), clock_(clock) {}
+
+  absl::StatusOr<PciCrawlerReadout> ReadPciCrawler(
+      const std::vector<std::string>& command) final;
+  absl::StatusOr<std::vector<std::string>> Glob(
+      const std::string& pattern) final;
+  absl::StatusOr<int> Open(const std::string& path) final;
+  absl::StatusOr<absl::string_view> Read(int handle,
+                                         absl::Span<char> buffer) final;
+  void Close(int handle) final {}
+
+ private:
+  const ReplayCapture& capture_;
+  Clock& clock_;
+  // Paths of the opened files, indexed by handle.
+  std::vector<std::string> paths_;
+};
+
+}  // namespace ocpdiag::error_monitor
+
+#endif  // OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_READOUT_SOURCE_H_
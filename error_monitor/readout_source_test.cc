@@ -0,0 +1,113 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/readout_source.h"
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "error_monitor/clock.h"
+#include "error_monitor/replay.h"
+
+namespace ocpdiag::error_monitor {
+namespace {
+
+using ::testing::ElementsAre;
+
+constexpr char kCapturePath[] = "error_monitor/testdata/replay_capture.jsonl";
+constexpr char kMc0Path[] = "/sys/devices/system/edac/mc/mc0/ce_count";
+constexpr char kMc1Path[] = "/sys/devices/system/edac/mc/mc1/ce_count";
+
+class CaptureReadoutSourceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    absl::StatusOr<std::unique_ptr<ReplayCapture>> capture =
+        ReplayCapture::Load(kCapturePath);
+    ASSERT_TRUE(capture.ok()) << capture.status();
+    capture_ = *std::move(capture);
+    clock_ = std::make_unique<SimulatedClock>(capture_->start_time());
+    readout_ = std::make_unique<CaptureReadoutSource>(*capture_, *clock_);
+  }
+
+  std::unique_ptr<ReplayCapture> capture_;
+  std::unique_ptr<SimulatedClock> clock_;
+  std::unique_ptr<CaptureReadoutSource> readout_;
+};
+
+TEST_F(CaptureReadoutSourceTest, LoadsSortedCapture) {
+  EXPECT_EQ(capture_->size(), 9);
+  EXPECT_EQ(capture_->end_time() - capture_->start_time(), absl::Hours(48));
+}
+
+TEST_F(CaptureReadoutSourceTest, GlobMatchesRecordedPaths) {
+  absl::StatusOr<std::vector<std::string>> paths =
+      readout_->Glob("/sys/devices/system/edac/mc/mc*/ce_count");
+  ASSERT_TRUE(paths.ok()) << paths.status();
+  EXPECT_THAT(*paths, ElementsAre(kMc0Path, kMc1Path));
+
+  paths = readout_->Glob("/sys/devices/system/edac/*/ce_count");
+  ASSERT_TRUE(paths.ok()) << paths.status();
+  EXPECT_TRUE(paths->empty());
+}
+
+TEST_F(CaptureReadoutSourceTest, ReadFollowsClock) {
+  absl::StatusOr<int> handle = readout_->Open(kMc1Path);
+  ASSERT_TRUE(handle.ok()) << handle.status();
+  std::array<char, 64> buffer;
+
+  // Times between snapshots see the latest earlier snapshot.
+  clock_->SleepFor(absl::Hours(41));
+  absl::StatusOr<absl::string_view> contents =
+      readout_->Read(*handle, absl::MakeSpan(buffer));
+  ASSERT_TRUE(contents.ok()) << contents.status();
+  EXPECT_EQ(*contents, "5\n");
+
+  clock_->SleepFor(absl::Hours(1));
+  contents = readout_->Read(*handle, absl::MakeSpan(buffer));
+  ASSERT_TRUE(contents.ok()) << contents.status();
+  EXPECT_EQ(*contents, "11\n");
+}
+
+TEST_F(CaptureReadoutSourceTest, ReadOfUnrecordedFileFails) {
+  absl::StatusOr<int> handle = readout_->Open("/sys/missing");
+  ASSERT_TRUE(handle.ok()) << handle.status();
+  std::array<char, 64> buffer;
+  EXPECT_EQ(readout_->Read(*handle, absl::MakeSpan(buffer)).status().code(),
+            absl::StatusCode::kNotFound);
+}
+
+TEST_F(CaptureReadoutSourceTest, PciCrawlerFollowsClock) {
+  clock_->SleepFor(absl::Hours(30));
+  absl::StatusOr<PciCrawlerReadout> readout =
+      readout_->ReadPciCrawler({"/usr/local/bin/pcicrawler"});
+  ASSERT_TRUE(readout.ok()) << readout.status();
+  EXPECT_EQ(readout->pci_links()
+                .at("0000:01:00.0")
+                .aer()
+                .device()
+                .aer_dev_correctable()
+                .at("BadTLP"),
+            2);
+}
+
+}  // namespace
+}  // namespace ocpdiag::error_monitor
@@ -0,0 +1,92 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/replay.h"
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <string>
+
+#include "google/protobuf/util/json_util.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/compat/status_converters.h"
+
+namespace ocpdiag::error_monitor {
+
+absl::StatusOr<std::unique_ptr<ReplayCapture>> ReplayCapture::Load(
+    absl::string_view path) {
+  std::ifstream file{std::string(path)};
+  if (!file.is_open()) {
+    return absl::NotFoundError(
+        absl::StrFormat("unable to open replay capture '%s'", path));
+  }
+
+  google::protobuf::util::JsonParseOptions opts;
+  opts.ignore_unknown_fields = true;
+
+  std::vector<ReplaySnapshot> snapshots;
+  std::string line;
+  for (int line_number = 1; std::getline(file, line); ++line_number) {
+    if (absl::StripAsciiWhitespace(line).empty()) {
+      continue;
+    }
+    ReplaySnapshot& snapshot = snapshots.emplace_back();
+    if (absl::Status status = AsAbslStatus(
+            google::protobuf::util::JsonStringToMessage(line, &snapshot, opts));
+        !status.ok()) {
+      return absl::InvalidArgumentError(
+          absl::StrFormat("%s:%d: malformed snapshot: %s", path, line_number,
+                          status.message()));
+    }
+  }
+  if (snapshots.empty()) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("replay capture '%s' holds no snapshots", path));
+  }
+
+  // Captures are usually recorded in order, but don't rely on it.
+  std::vector<int> order(snapshots.size());
+  std::iota(order.begin(), order.end(), 0);
+  auto time_of = [&snapshots](int i) {
+    const google::protobuf::Timestamp& ts = snapshots[i].timestamp();
+    return absl::FromUnixSeconds(ts.seconds()) + absl::Nanoseconds(ts.nanos());
+  };
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int a, int b) { return time_of(a) < time_of(b); });
+
+  auto capture = std::unique_ptr<ReplayCapture>(new ReplayCapture());
+  capture->timestamps_.reserve(order.size());
+  capture->snapshots_.reserve(order.size());
+  for (int i : order) {
+    capture->timestamps_.push_back(time_of(i));
+    capture->snapshots_.push_back(std::move(snapshots[i]));
+  }
+  return capture;
+}
+
+const ReplaySnapshot& ReplayCapture::SnapshotAt(absl::Time now) const {
+  auto it = std::upper_bound(timestamps_.begin(), timestamps_.end(), now);
+  if (it == timestamps_.begin()) {
+    return snapshots_.front();
+  }
+  return snapshots_[std::distance(timestamps_.begin(), it) - 1];
+}
+
+}  // namespace ocpdiag::error_monitor
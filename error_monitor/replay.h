@@ -0,0 +1,56 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_REPLAY_H_
+#define OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_REPLAY_H_
+
+#include <memory>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "error_monitor/replay.pb.h"
+
+namespace ocpdiag::error_monitor {
+
+// A recorded sequence of hardware snapshots, replayed in place of the live
+// error sources. Snapshots are kept sorted by timestamp.
+class ReplayCapture {
+ public:
+  // Loads a capture from a file holding one JSON ReplaySnapshot per line.
+  // Blank lines are skipped. Fails if the file holds no snapshots.
+  static absl::StatusOr<std::unique_ptr<ReplayCapture>> Load(
+      absl::string_view path);
+
+  // Returns the latest snapshot recorded at or before `now`. Times before the
+  // first snapshot map onto the first snapshot.
+  const ReplaySnapshot& SnapshotAt(absl::Time now) const;
+
+  // Timestamp of the first and last snapshot.
+  absl::Time start_time() const { return timestamps_.front(); }
+  absl::Time end_time() const { return timestamps_.back(); }
+
+  int size() const { return snapshots_.size(); }
+
+ private:
+  ReplayCapture() = default;
+
+  std::vector<absl::Time> timestamps_;
+  std::vector<ReplaySnapshot> snapshots_;
+};
+
+}  // namespace ocpdiag::error_monitor
+
+#endif  // OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_REPLAY_H_
@@ -0,0 +1,262 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/snapshot_server.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/util/json_util.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::error_monitor {
+
+namespace {
+
+// How often the event loop checks for shutdown.
+constexpr int kAcceptPollMillis = 200;
+// Clients that send no request within this time get JSON.
+constexpr absl::Duration kRequestTimeout = absl::Seconds(1);
+// Connections still open after this long are dropped.
+constexpr absl::Duration kClientTimeout = absl::Seconds(5);
+// Connections beyond this many are closed on accept.
+constexpr size_t kMaxClients = 64;
+// Requests are a single short keyword.
+constexpr size_t kMaxRequestBytes = 64;
+
+absl::Status ErrnoError(absl::string_view what, absl::string_view path) {
+  return absl::UnavailableError(
+      absl::StrFormat("%s '%s': %s", what, path, strerror(errno)));
+}
+
+// Returns whether a server is accepting connections at `addr`.
+absl::StatusOr<bool> SocketIsLive(const sockaddr_un& addr) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return ErrnoError("unable to create snapshot socket", addr.sun_path);
+  }
+  int rc = connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+  int error = errno;
+  close(fd);
+  if (rc == 0) {
+    return true;
+  }
+  if (error == ECONNREFUSED) {
+    return false;
+  }
+  errno = error;
+  return ErrnoError("unable to probe existing socket", addr.sun_path);
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<SnapshotServer>> SnapshotServer::Start(
+    absl::string_view socket_path) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("snapshot socket path too long: '%s'", socket_path));
+  }
+  memcpy(addr.sun_path, socket_path.data(), socket_path.size());
+
+  struct stat st;
+  if (lstat(addr.sun_path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      return absl::AlreadyExistsError(absl::StrFormat(
+          "snapshot socket path '%s' exists and is not a socket",
+          socket_path));
+    }
+    absl::StatusOr<bool> live = SocketIsLive(addr);
+    if (!live.ok()) {
+      return live.status();
+    }
+    if (*live) {
+      return absl::AlreadyExistsError(absl::StrFormat(
+          "snapshot socket '%s' is in use by another server", socket_path));
+    }
+    unlink(addr.sun_path);
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    return ErrnoError("unable to create snapshot socket", socket_path);
+  }
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    absl::Status status = ErrnoError("unable to bind", socket_path);
+    close(fd);
+    return status;
+  }
+  if (listen(fd, SOMAXCONN) != 0) {
+    absl::Status status = ErrnoError("unable to listen on", socket_path);
+    close(fd);
+    unlink(addr.sun_path);
+    return status;
+  }
+
+  auto server = std::unique_ptr<SnapshotServer>(
+      new SnapshotServer(std::string(socket_path), fd));
+  server->Publish(MonitorSnapshot());
+  server->thread_ = std::thread(&SnapshotServer::Serve, server.get());
+  return server;
+}
+
+SnapshotServer::SnapshotServer(std::string socket_path, int listen_fd)
+    : socket_path_(std::move(socket_path)), listen_fd_(listen_fd) {}
+
+SnapshotServer::~SnapshotServer() {
+  stop_.store(true);
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  close(listen_fd_);
+  unlink(socket_path_.c_str());
+}
+
+void SnapshotServer::Publish(const MonitorSnapshot& snapshot) {
+  auto encoded = std::make_shared<Encoded>();
+  snapshot.SerializeToString(&encoded->binary);
+  google::protobuf::util::JsonPrintOptions opts;
+  opts.preserve_proto_field_names = true;
+  (void)google::protobuf::util::MessageToJsonString(snapshot, &encoded->json,
+                                                    opts);
+  encoded->json.push_back('\n');
+  std::atomic_store(&current_,
+                    std::shared_ptr<const Encoded>(std::move(encoded)));
+}
+
+void SnapshotServer::Serve() {
+  std::vector<Client> clients;
+  std::vector<pollfd> pfds;
+  while (!stop_.load()) {
+    pfds.clear();
+    pfds.push_back({listen_fd_, POLLIN, 0});
+    for (const Client& client : clients) {
+      pfds.push_back(
+          {client.fd, static_cast<short>(client.reply ? POLLOUT : POLLIN), 0});
+    }
+    // Wake for the nearest client deadline as well as for shutdown.
+    absl::Duration wait = absl::Milliseconds(kAcceptPollMillis);
+    const absl::Time now = absl::Now();
+    for (const Client& client : clients) {
+      absl::Duration timeout = client.reply ? kClientTimeout : kRequestTimeout;
+      wait = std::min(wait, client.accepted + timeout - now);
+    }
+    int ready = poll(pfds.data(), pfds.size(),
+                     std::max<int64_t>(0, absl::ToInt64Milliseconds(wait)));
+    if (ready < 0) {
+      continue;
+    }
+
+    std::vector<Client> remaining;
+    for (size_t i = 0; i < clients.size(); ++i) {
+      if (Advance(clients[i], pfds[i + 1].revents)) {
+        close(clients[i].fd);
+      } else {
+        remaining.push_back(std::move(clients[i]));
+      }
+    }
+    clients = std::move(remaining);
+    if (pfds[0].revents & POLLIN) {
+      Accept(clients);
+    }
+  }
+  for (const Client& client : clients) {
+    close(client.fd);
+  }
+}
+
+void SnapshotServer::Accept(std::vector<Client>& clients) {
+  while (true) {
+    int client_fd =
+        accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (client_fd < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    if (clients.size() >= kMaxClients) {
+      close(client_fd);
+      continue;
+    }
+    clients.push_back({client_fd, absl::Now()});
+  }
+}
+
+bool SnapshotServer::Advance(Client& client, short revents) {
+  const absl::Duration age = absl::Now() - client.accepted;
+  if (age >= kClientTimeout || (revents & (POLLERR | POLLNVAL))) {
+    return true;
+  }
+
+  if (!client.reply) {
+    // Read up to the first newline. A client that sends nothing gets JSON
+    // once the request timeout expires, or immediately if it shuts down its
+    // write side.
+    bool done = age >= kRequestTimeout;
+    if (revents & (POLLIN | POLLHUP)) {
+      char buffer[kMaxRequestBytes];
+      ssize_t n = recv(client.fd, buffer, sizeof(buffer), 0);
+      if (n > 0) {
+        client.request.append(buffer, n);
+      } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        done = true;
+      }
+    }
+    if (!done && client.request.size() < kMaxRequestBytes &&
+        client.request.find('\n') == std::string::npos) {
+      return false;
+    }
+    StartReply(client);
+  }
+
+  // Write as much as the client takes without blocking.
+  while (!client.unsent.empty()) {
+    ssize_t written = send(client.fd, client.unsent.data(),
+                           client.unsent.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (written < 0 && errno == EINTR) continue;
+    if (written < 0 && errno == EAGAIN) return false;
+    if (written <= 0) return true;
+    client.unsent.remove_prefix(written);
+  }
+  return true;
+}
+
+void SnapshotServer::StartReply(Client& client) {
+  client.reply = std::atomic_load(&current_);
+  if (absl::StripAsciiWhitespace(client.request) == "binary") {
+    client.unsent = client.reply->binary;
+  } else {
+    client.unsent = client.reply->json;
+  }
+}
+
+}  // namespace ocpdiag::error_monitor
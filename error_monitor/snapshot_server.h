@@ -0,0 +1,96 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_SNAPSHOT_SERVER_H_
+#define OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_SNAPSHOT_SERVER_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "error_monitor/snapshot.pb.h"
+
+namespace ocpdiag::error_monitor {
+
+// Serves the latest MonitorSnapshot, read-only, over a Unix domain socket.
+//
+// A client connects, optionally writes a request line, and reads the reply
+// until EOF. The request "binary\n" returns the serialized MonitorSnapshot
+// proto; anything else (including no request) returns it as JSON.
+//
+// Snapshots are encoded once by the publisher and swapped in atomically, so
+// readers never hold up polling and polling never waits on readers. Clients
+// are served concurrently with non-blocking I/O, so a stalled reader does
+// not delay others; each connection is dropped after a fixed total time.
+class SnapshotServer {
+ public:
+  // Binds `socket_path` and starts serving on a background thread. A stale
+  // socket left at `socket_path`, one that refuses connections, is replaced.
+  // A socket that accepts connections belongs to a live server and is an
+  // error, as is any other file.
+  static absl::StatusOr<std::unique_ptr<SnapshotServer>> Start(
+      absl::string_view socket_path);
+
+  // Stops serving and removes the socket.
+  ~SnapshotServer();
+
+  SnapshotServer(const SnapshotServer&) = delete;
+  SnapshotServer& operator=(const SnapshotServer&) = delete;
+
+  // Replaces the snapshot served to new requests.
+  void Publish(const MonitorSnapshot& snapshot);
+
+ private:
+  struct Encoded {
+    std::string binary;
+    std::string json;
+  };
+
+  // A connection being served.
+  struct Client {
+    int fd;
+    absl::Time accepted;
+    std::string request;
+    // Set once the request is read. Holds `unsent` alive.
+    std::shared_ptr<const Encoded> reply;
+    absl::string_view unsent;
+  };
+
+  SnapshotServer(std::string socket_path, int listen_fd);
+
+  // Event loop, run on `thread_`.
+  void Serve();
+  // Accepts pending connections onto `clients`.
+  void Accept(std::vector<Client>& clients);
+  // Makes progress on `client` and returns whether it is finished.
+  bool Advance(Client& client, short revents);
+  // Picks the reply to `client`'s request.
+  void StartReply(Client& client);
+
+  const std::string socket_path_;
+  const int listen_fd_;
+  std::atomic<bool> stop_ = false;
+  // Accessed with std::atomic_load/atomic_store only.
+  std::shared_ptr<const Encoded> current_;
+  std::thread thread_;
+};
+
+}  // namespace ocpdiag::error_monitor
+
+#endif  // OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_SNAPSHOT_SERVER_H_
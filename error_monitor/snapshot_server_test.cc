@@ -0,0 +1,132 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/snapshot_server.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "error_monitor/snapshot.pb.h"
+
+namespace ocpdiag::error_monitor {
+namespace {
+
+std::string SocketPath(absl::string_view name) {
+  return absl::StrCat(::testing::TempDir(), "/", name, ".sock");
+}
+
+sockaddr_un Address(const std::string& path) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.data(), path.size());
+  return addr;
+}
+
+// Returns a socket connected to the server at `path`, or -1.
+int Connect(const std::string& path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr = Address(path);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Sends `request` on `fd` and returns everything read until EOF.
+std::string Query(int fd, absl::string_view request) {
+  send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+  std::string reply;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    reply.append(buffer, n);
+  }
+  close(fd);
+  return reply;
+}
+
+MonitorSnapshot SnapshotWithPolls(int polls) {
+  MonitorSnapshot snapshot;
+  snapshot.set_poll_count(polls);
+  return snapshot;
+}
+
+TEST(SnapshotServerTest, ServesBinaryAndJson) {
+  const std::string path = SocketPath("serves");
+  absl::StatusOr<std::unique_ptr<SnapshotServer>> server =
+      SnapshotServer::Start(path);
+  ASSERT_TRUE(server.ok()) << server.status();
+  (*server)->Publish(SnapshotWithPolls(7));
+
+  MonitorSnapshot decoded;
+  ASSERT_TRUE(decoded.ParseFromString(Query(Connect(path), "binary\n")));
+  EXPECT_EQ(decoded.poll_count(), 7);
+  EXPECT_EQ(Query(Connect(path), "json\n"), "{\"poll_count\":\"7\"}\n");
+}
+
+TEST(SnapshotServerTest, StalledClientDoesNotDelayOthers) {
+  const std::string path = SocketPath("stalled");
+  absl::StatusOr<std::unique_ptr<SnapshotServer>> server =
+      SnapshotServer::Start(path);
+  ASSERT_TRUE(server.ok()) << server.status();
+
+  // Connects but never sends a request nor reads the reply.
+  int stalled = Connect(path);
+  ASSERT_GE(stalled, 0);
+  absl::Time start = absl::Now();
+  EXPECT_FALSE(Query(Connect(path), "json\n").empty());
+  EXPECT_LT(absl::Now() - start, absl::Milliseconds(500));
+  close(stalled);
+}
+
+TEST(SnapshotServerTest, RefusesSocketOfLiveServer) {
+  const std::string path = SocketPath("live");
+  absl::StatusOr<std::unique_ptr<SnapshotServer>> first =
+      SnapshotServer::Start(path);
+  ASSERT_TRUE(first.ok()) << first.status();
+
+  EXPECT_EQ(SnapshotServer::Start(path).status().code(),
+            absl::StatusCode::kAlreadyExists);
+  // The first server keeps its endpoint.
+  EXPECT_FALSE(Query(Connect(path), "json\n").empty());
+}
+
+TEST(SnapshotServerTest, ReplacesStaleSocket) {
+  const std::string path = SocketPath("stale");
+  unlink(path.c_str());
+  // A socket file nobody listens on, as left behind by a crashed monitor.
+  int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr = Address(path);
+  ASSERT_EQ(bind(stale, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+  close(stale);
+
+  absl::StatusOr<std::unique_ptr<SnapshotServer>> server =
+      SnapshotServer::Start(path);
+  ASSERT_TRUE(server.ok()) << server.status();
+  EXPECT_FALSE(Query(Connect(path), "json\n").empty());
+}
+
+}  // namespace
+}  // namespace ocpdiag::error_monitor
@@ -0,0 +1,184 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures how a SysfsCounterReader read pass scales with the number of NUMA
+// nodes it is sharded over, on a fake sysfs tree in a temporary directory.
+//
+// The files of the fake tree are plain files, which are much cheaper to read
+// than sysfs attributes whose show() touches device registers. Each read can
+// be given an extra cost, spent spinning, to model the latter.
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "error_monitor/readout_source.h"
+#include "error_monitor/sysfs_counters/sysfs_counter_step.h"
+
+namespace ocpdiag::error_monitor {
+namespace {
+
+constexpr int kFiles = 4096;
+constexpr int kPasses = 50;
+
+// Live reads that each take at least `cost`.
+class SlowReadoutSource final : public ReadoutSource {
+ public:
+  explicit SlowReadoutSource(absl::Duration cost) : cost_(cost) {}
+
+  absl::StatusOr<PciCrawlerReadout> ReadPciCrawler(
+      const std::vector<std::string>& command) final {
+    return live_.ReadPciCrawler(command);
+  }
+  absl::StatusOr<std::vector<std::string>> Glob(
+      const std::string& pattern) final {
+    return live_.Glob(pattern);
+  }
+  absl::StatusOr<int> Open(const std::string& path) final {
+    return live_.Open(path);
+  }
+  absl::StatusOr<absl::string_view> Read(int handle,
+                                         absl::Span<char> buffer) final {
+    const absl::Time end = absl::Now() + cost_;
+    absl::StatusOr<absl::string_view> contents = live_.Read(handle, buffer);
+    while (absl::Now() < end) {
+    }
+    return contents;
+  }
+  void Close(int handle) final { live_.Close(handle); }
+
+ private:
+  const absl::Duration cost_;
+  LiveReadoutSource live_;
+};
+
+void WriteFile(const std::filesystem::path& path, absl::string_view contents) {
+  std::filesystem::create_directories(path.parent_path());
+  std::ofstream(path) << contents;
+}
+
+// Builds a tree of `nodes` NUMA nodes sharing `kFiles` AER files evenly, and
+// gives each node a distinct allowed CPU where there are enough.
+std::vector<std::string> BuildTree(const std::filesystem::path& root,
+                                   int nodes) {
+  std::filesystem::remove_all(root);
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+  }
+  for (int node = 0; node < nodes; ++node) {
+    WriteFile(root / absl::StrCat("devices/system/node/node", node, "/cpulist"),
+              absl::StrCat(cpus[node % cpus.size()], "\n"));
+  }
+  std::vector<std::string> paths;
+  for (int i = 0; i < kFiles; ++i) {
+    const std::filesystem::path dir =
+        root / absl::StrCat("devices/pci", i % nodes, "/dev", i);
+    WriteFile(dir / "numa_node", absl::StrCat(i % nodes, "\n"));
+    WriteFile(dir / "aer_dev_correctable",
+              "RxErr 0\nBadTLP 3\nBadDLLP 0\nRollover 0\nTimeout 1\n");
+    paths.push_back((dir / "aer_dev_correctable").string());
+  }
+  return paths;
+}
+
+void Run(const std::filesystem::path& root, int nodes, absl::Duration cost,
+         int64_t max_open_files) {
+  const std::vector<std::string> paths = BuildTree(root, nodes);
+  SlowReadoutSource readout(cost);
+  absl::Duration unsharded;
+  for (bool by_node : {false, true}) {
+    SysfsCounterReader reader(readout, root.string());
+    reader.set_max_open_files(max_open_files);
+    for (const std::string& path : paths) {
+      if (absl::StatusOr<const SysfsCounterFile*> file =
+              reader.AddFile(path, SysfsCounterSource::KEY_VALUE);
+          !file.ok()) {
+        std::fprintf(stderr, "%s\n", file.status().ToString().c_str());
+        return;
+      }
+    }
+    reader.Shard(by_node);
+    const absl::Time start = absl::Now();
+    for (int pass = 0; pass < kPasses; ++pass) {
+      if (absl::Status status = reader.Read(); !status.ok()) {
+        std::fprintf(stderr, "%s\n", status.ToString().c_str());
+        return;
+      }
+    }
+    const absl::Duration per_pass = (absl::Now() - start) / kPasses;
+    if (!by_node) {
+      unsharded = per_pass;
+      continue;
+    }
+    std::printf(
+        "%d nodes, %5.1f us/read: %9.1f us/pass unsharded, %9.1f us/pass "
+        "sharded (%.2fx)\n",
+        nodes, absl::ToDoubleMicroseconds(cost),
+        absl::ToDoubleMicroseconds(unsharded),
+        absl::ToDoubleMicroseconds(per_pass),
+        absl::FDivDuration(unsharded, per_pass));
+  }
+}
+
+}  // namespace
+}  // namespace ocpdiag::error_monitor
+
+int main() {
+  namespace internal = ::ocpdiag::error_monitor::internal;
+  const std::filesystem::path root =
+      std::filesystem::temp_directory_path() /
+      absl::StrCat("sysfs_counter_benchmark.", getpid());
+  // The files are kept open as the module does, which needs more than the
+  // usual soft limit of 1024 descriptors.
+  absl::StatusOr<int64_t> limit = internal::RaiseOpenFileLimit();
+  if (!limit.ok()) {
+    std::fprintf(stderr, "%s\n", limit.status().ToString().c_str());
+    return 1;
+  }
+  const int64_t max_open_files =
+      *limit - internal::OpenFileCount() - internal::kReservedFileDescriptors;
+  std::printf("%d KEY_VALUE files, 5 counters each\n",
+              ocpdiag::error_monitor::kFiles);
+  if (max_open_files < ocpdiag::error_monitor::kFiles) {
+    std::printf(
+        "RLIMIT_NOFILE of %lld keeps only %lld files open; the rest are "
+        "reopened on every read\n",
+        static_cast<long long>(*limit),
+        static_cast<long long>(max_open_files));
+  }
+  for (absl::Duration cost : {absl::ZeroDuration(), absl::Microseconds(2)}) {
+    for (int nodes : {1, 2, 4, 8}) {
+      ocpdiag::error_monitor::Run(root, nodes, cost, max_open_files);
+    }
+  }
+  std::filesystem::remove_all(root);
+  return 0;
+}
@@ -0,0 +1,655 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/sysfs_counters/sysfs_counter_step.h"
+
+#include <sched.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "ocpdiag/core/compat/status_macros.h"
+#include "ocpdiag/core/results/results.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "lib/numa_info/numa_info.h"
+
+namespace ocpdiag::error_monitor {
+
+namespace rpb = ::ocpdiag::results_pb;
+
+namespace {
+
+constexpr char kDefaultHardwareNameTemplate[] = "{-2}";
+
+absl::string_view Basename(absl::string_view path) {
+  return path.substr(path.rfind('/') + 1);
+}
+
+}  // namespace
+
+namespace internal {
+
+std::string ExpandHardwareName(absl::string_view name_template,
+                               absl::string_view path) {
+  std::vector<absl::string_view> components =
+      absl::StrSplit(path, '/', absl::SkipEmpty());
+  std::string name;
+  while (!name_template.empty()) {
+    size_t open = name_template.find('{');
+    size_t close = name_template.find('}', open);
+    if (open == absl::string_view::npos || close == absl::string_view::npos) {
+      break;
+    }
+    absl::StrAppend(&name, name_template.substr(0, open));
+    absl::string_view token =
+        name_template.substr(open + 1, close - open - 1);
+    int from_end;
+    if (token == "path") {
+      absl::StrAppend(&name, path);
+    } else if (absl::SimpleAtoi(token, &from_end) && from_end < 0) {
+      if (-from_end <= static_cast<int>(components.size())) {
+        absl::StrAppend(&name, components[components.size() + from_end]);
+      }
+    } else {
+      absl::StrAppend(&name, name_template.substr(open, close - open + 1));
+    }
+    name_template.remove_prefix(close + 1);
+  }
+  absl::StrAppend(&name, name_template);
+  return name;
+}
+
+absl::Status ParseKeyValueCounters(absl::string_view contents,
+                                   absl::Span<const std::string> keys,
+                                   absl::Span<int64_t> values) {
+  // Files normally list their keys in the same order on every read, so try
+  // the next expected key before searching.
+  size_t expected = 0;
+  for (absl::string_view line :
+       absl::StrSplit(contents, '\n', absl::SkipWhitespace())) {
+    line = absl::StripLeadingAsciiWhitespace(line);
+    size_t split = line.find_first_of(" \t");
+    absl::string_view key = line.substr(0, split);
+    absl::string_view value =
+        split == absl::string_view::npos ? "" : line.substr(split);
+
+    size_t k = expected;
+    if (k >= keys.size() || keys[k] != key) {
+      k = std::find(keys.begin(), keys.end(), key) - keys.begin();
+      if (k == keys.size()) continue;
+    }
+    if (!absl::SimpleAtoi(value, &values[k])) {
+      return absl::InvalidArgumentError(
+          absl::StrFormat("%s: '%s'", key, value));
+    }
+    expected = k + 1;
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<int64_t> RaiseOpenFileLimit() {
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+    return absl::InternalError(
+        absl::StrFormat("getrlimit(RLIMIT_NOFILE): %s", strerror(errno)));
+  }
+  if (limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+      return absl::InternalError(
+          absl::StrFormat("setrlimit(RLIMIT_NOFILE): %s", strerror(errno)));
+    }
+  }
+  if (limit.rlim_cur == RLIM_INFINITY) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  return static_cast<int64_t>(limit.rlim_cur);
+}
+
+int64_t OpenFileCount() {
+  std::error_code error;
+  int64_t count = 0;
+  for (std::filesystem::directory_iterator it("/proc/self/fd", error), end;
+       !error && it != end; it.increment(error)) {
+    ++count;
+  }
+  return count;
+}
+
+}  // namespace internal
+
+SysfsCounterReader::~SysfsCounterReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  start_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+  for (const SysfsCounterFile& file : files_) {
+    if (file.handle >= 0) readout_.Close(file.handle);
+  }
+}
+
+absl::StatusOr<const SysfsCounterFile*> SysfsCounterReader::AddFile(
+    const std::string& path, SysfsCounterSource::Format format) {
+  SysfsCounterFile file;
+  file.path = path;
+  file.format = format;
+  file.first_counter = values_.size();
+  ASSIGN_OR_RETURN(file.handle, readout_.Open(path));
+  if (format == SysfsCounterSource::KEY_VALUE) {
+    std::array<char, 4096> buffer;
+    absl::StatusOr<absl::string_view> contents = ReadFile(file, buffer);
+    if (!contents.ok()) {
+      readout_.Close(file.handle);
+      return contents.status();
+    }
+    for (absl::string_view line :
+         absl::StrSplit(*contents, '\n', absl::SkipWhitespace())) {
+      line = absl::StripLeadingAsciiWhitespace(line);
+      file.keys.emplace_back(line.substr(0, line.find_first_of(" \t")));
+    }
+  }
+  values_.resize(values_.size() + (format == SysfsCounterSource::KEY_VALUE
+                                       ? file.keys.size()
+                                       : 1));
+  if (open_files_ < max_open_files_) {
+    ++open_files_;
+  } else {
+    readout_.Close(file.handle);
+    file.handle = -1;
+  }
+  files_.push_back(std::move(file));
+  return &files_.back();
+}
+
+absl::StatusOr<absl::string_view> SysfsCounterReader::ReadFile(
+    const SysfsCounterFile& file, std::array<char, 4096>& buffer) {
+  int handle = file.handle;
+  if (handle < 0) {
+    ASSIGN_OR_RETURN(handle, readout_.Open(file.path));
+  }
+  absl::StatusOr<absl::string_view> contents =
+      readout_.Read(handle, absl::MakeSpan(buffer));
+  if (file.handle < 0) {
+    readout_.Close(handle);
+  }
+  if (!contents.ok()) {
+    return absl::UnknownError(absl::StrFormat(
+        "Failed to read %s: %s", file.path, contents.status().message()));
+  }
+  return contents;
+}
+
+void SysfsCounterReader::Shard(bool by_numa_node) {
+  if (!by_numa_node) {
+    SysfsReadShard& shard = shards_.emplace_back();
+    for (size_t i = 0; i < files_.size(); ++i) {
+      shard.files.push_back(i);
+    }
+    return;
+  }
+
+  // Stay within the CPUs the monitor was already confined to, e.g. by
+  // low-interference mode.
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    CPU_ZERO(&allowed);
+  }
+
+  std::map<int, SysfsReadShard> by_node;
+  for (size_t i = 0; i < files_.size(); ++i) {
+    int node = NumaNodeOfSysfsPath(files_[i].path, sysfs_root_);
+    auto [it, inserted] = by_node.try_emplace(node);
+    if (inserted) {
+      it->second.numa_node = node;
+      for (int cpu : CpusOfNumaNode(node, sysfs_root_)) {
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+          it->second.cpus.push_back(cpu);
+        }
+      }
+    }
+    it->second.files.push_back(i);
+  }
+  for (auto& [node, shard] : by_node) {
+    shards_.push_back(std::move(shard));
+  }
+
+  // A single shard is read on the polling thread.
+  if (shards_.size() > 1) {
+    for (SysfsReadShard& shard : shards_) {
+      threads_.emplace_back(&SysfsCounterReader::RunShard, this,
+                            std::ref(shard));
+    }
+  }
+}
+
+void SysfsCounterReader::RunShard(SysfsReadShard& shard) {
+  if (!shard.cpus.empty()) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : shard.cpus) {
+      CPU_SET(cpu, &cpus);
+    }
+    // Best effort; an unpinned read is still correct.
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+  }
+
+  int64_t generation = 0;
+  while (true) {
+    size_t begin, end;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_.wait(lock,
+                  [&] { return stopping_ || generation_ != generation; });
+      if (stopping_) return;
+      generation = generation_;
+      begin = pass_begin_;
+      end = pass_end_;
+    }
+    shard.status = ReadShard(shard, begin, end);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --pending_;
+    }
+    done_.notify_one();
+  }
+}
+
+absl::Status SysfsCounterReader::Read(int slice, int slices) {
+  const size_t begin = files_.size() * slice / slices;
+  const size_t end = files_.size() * (slice + 1) / slices;
+  if (threads_.empty()) {
+    for (SysfsReadShard& shard : shards_) {
+      RETURN_IF_ERROR(ReadShard(shard, begin, end));
+    }
+    return absl::OkStatus();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++generation_;
+    pass_begin_ = begin;
+    pass_end_ = end;
+    pending_ = threads_.size();
+  }
+  start_.notify_all();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+  }
+  for (const SysfsReadShard& shard : shards_) {
+    RETURN_IF_ERROR(shard.status);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SysfsCounterReader::ReadShard(SysfsReadShard& shard,
+                                            size_t begin, size_t end) {
+  // Shard files are in file table order.
+  for (auto it = std::lower_bound(shard.files.begin(), shard.files.end(),
+                                  static_cast<int>(begin));
+       it != shard.files.end() && *it < static_cast<int>(end); ++it) {
+    const SysfsCounterFile& file = files_[*it];
+    ASSIGN_OR_RETURN(absl::string_view contents, ReadFile(file, shard.buffer));
+    int64_t* values = values_.data() + file.first_counter;
+
+    if (file.format == SysfsCounterSource::VALUE) {
+      if (!absl::SimpleAtoi(contents, values)) {
+        return absl::InvalidArgumentError(absl::StrFormat(
+            "Unable to parse counter %s: '%s'", file.path, contents));
+      }
+      continue;
+    }
+
+    if (absl::Status status = internal::ParseKeyValueCounters(
+            contents, file.keys, absl::MakeSpan(values, file.keys.size()));
+        !status.ok()) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "Unable to parse counter %s:%s", file.path, status.message()));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::vector<std::string>>
+SysfsCounterMonitorModule::DiscoverFiles() {
+  std::vector<std::string> paths;
+  for (const std::string& pattern : source_.globs()) {
+    ASSIGN_OR_RETURN(std::vector<std::string> matches,
+                     readout_.Glob(pattern));
+    paths.insert(paths.end(), matches.begin(), matches.end());
+  }
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+  return paths;
+}
+
+absl::Status SysfsCounterMonitorModule::LoadHwInfos(
+    results::DutInfo& dut_info) {
+  ASSIGN_OR_RETURN(const std::vector<std::string> paths, DiscoverFiles());
+  if (paths.empty()) {
+    test_run_.LogWarn(absl::StrFormat(
+        "No counter files found for sysfs source %s", source_.name()));
+  }
+
+  // Every counter file stays open between polls, which can take more
+  // descriptors than the usual soft limit of 1024 allows.
+  ASSIGN_OR_RETURN(const int64_t limit, internal::RaiseOpenFileLimit());
+  const int64_t available =
+      std::max<int64_t>(0, limit - internal::OpenFileCount() -
+                               internal::kReservedFileDescriptors);
+  if (static_cast<int64_t>(paths.size()) > available) {
+    test_run_.LogError(absl::StrFormat(
+        "sysfs source %s has %d counter files, but the open file limit "
+        "(RLIMIT_NOFILE) of %d only leaves room to keep %d open; the rest "
+        "are reopened on every poll. Raise the hard limit to avoid this.",
+        source_.name(), paths.size(), limit, available));
+  }
+  reader_.set_max_open_files(available);
+
+  absl::string_view name_template = source_.hardware_name_template();
+  if (name_template.empty()) {
+    name_template = kDefaultHardwareNameTemplate;
+  }
+  absl::flat_hash_map<std::string, int> hardware_index;
+  // Path of the file of each "{hardware}/{counter}".
+  absl::flat_hash_map<std::string, std::string> counter_paths;
+
+  for (const std::string& path : paths) {
+    ASSIGN_OR_RETURN(const SysfsCounterFile* file,
+                     reader_.AddFile(path, source_.format()));
+    if (file->format == SysfsCounterSource::KEY_VALUE && file->keys.empty()) {
+      test_run_.LogWarn(absl::StrFormat(
+          "Counter file %s of sysfs source %s has no keys; it is not "
+          "monitored.",
+          path, source_.name()));
+    }
+
+    std::string hardware_name =
+        internal::ExpandHardwareName(name_template, path);
+    auto [it, inserted] =
+        hardware_index.try_emplace(hardware_name, hardware_.size());
+    if (inserted) {
+      SysfsHardwareTracker& tracker = hardware_.emplace_back();
+      tracker.name = hardware_name;
+      rpb::HardwareInfo hw_info;
+      hw_info.set_name(absl::StrFormat("%s:%s", source_.name(), hardware_name));
+      hw_info.set_part_type(source_.name());
+      tracker.hw_record = dut_info.AddHardware(hw_info);
+    }
+
+    std::vector<std::string> counter_names;
+    for (const std::string& key : file->keys) {
+      counter_names.push_back(absl::StrFormat("%s:%s", Basename(path), key));
+    }
+    if (file->format == SysfsCounterSource::VALUE) {
+      counter_names.emplace_back(Basename(path));
+    }
+
+    for (std::string& name : counter_names) {
+      auto [other, unique] = counter_paths.try_emplace(
+          absl::StrFormat("%s/%s", hardware_name, name), path);
+      if (!unique) {
+        return absl::InvalidArgumentError(absl::StrFormat(
+            "sysfs source %s: %s and %s are both counter %s; "
+            "hardware_name_template '%s' is too coarse to tell them apart.",
+            source_.name(), other->second, path, other->first,
+            name_template));
+      }
+      hardware_[it->second].counters.push_back(counter_names_.size());
+      counter_hardware_.push_back(it->second);
+      counter_names_.push_back(std::move(name));
+    }
+  }
+  reader_.Shard(params_.numa_sharded_collection());
+  if (params_.numa_sharded_collection()) {
+    for (const SysfsReadShard& shard : reader_.shards()) {
+      test_run_.LogDebug(absl::StrFormat(
+          "sysfs source %s: %d files on numa node %d, %d cpus",
+          source_.name(), shard.files.size(), shard.numa_node,
+          shard.cpus.size()));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SysfsCounterMonitorModule::StartMonitoring() {
+  for (SysfsHardwareTracker& tracker : hardware_) {
+    ASSIGN_OR_RETURN(
+        tracker.step,
+        result_api_.BeginTestStep(
+            &test_run_,
+            absl::StrFormat("monitor-%s-%s", source_.name(), tracker.name)));
+  }
+
+  rpb::MeasurementInfo measurement_info;
+  measurement_info.set_unit("count");
+  series_.resize(counter_names_.size());
+  histories_.resize(counter_names_.size());
+  int untracked = 0;
+  for (size_t i = 0; i < counter_names_.size(); ++i) {
+    SysfsHardwareTracker& tracker = hardware_[counter_hardware_[i]];
+    measurement_info.set_name(counter_names_[i]);
+    ASSIGN_OR_RETURN(series_[i], result_api_.BeginMeasurementSeries(
+                                     tracker.step.get(), tracker.hw_record,
+                                     measurement_info));
+    histories_[i] = history_.Track(absl::StrFormat(
+        "%s/%s/%s", source_.name(), tracker.name, counter_names_[i]));
+    untracked += histories_[i] == nullptr;
+  }
+  if (untracked > 0) {
+    test_run_.LogWarn(absl::StrFormat(
+        "Shared counter history budget of %d KiB holds %d of %d %s "
+        "counters; the rest have no history.",
+        params_.history_budget_kib(), counter_names_.size() - untracked,
+        counter_names_.size(), source_.name()));
+  }
+
+  RETURN_IF_ERROR(reader_.Read());
+  day_baselines_ = reader_.values();
+  day_start_ = clock_.Now();
+  exceeded_.assign(counter_names_.size(), false);
+
+  if (params_.has_anomaly_detection()) {
+    anomaly_detector_ = std::make_unique<RateAnomalyDetector>(
+        params_.anomaly_detection(), counter_names_.size());
+    detector_values_.resize(counter_names_.size());
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SysfsCounterMonitorModule::ReadCounters() {
+  if (poll_window_ <= absl::ZeroDuration()) {
+    return reader_.Read();
+  }
+  const int slices = std::max<int>(
+      1, (reader_.file_count() + internal::kFilesPerReadSlice - 1) /
+             internal::kFilesPerReadSlice);
+  const absl::Time window_start = clock_.Now();
+  // Once monitoring is stopping, the rest is read without waiting so that
+  // the poll still sees every counter.
+  bool waiting = true;
+  for (int slice = 0; slice < slices; ++slice) {
+    if (slice > 0 && waiting) {
+      waiting = wait_until_(window_start + poll_window_ * slice / slices);
+    }
+    RETURN_IF_ERROR(reader_.Read(slice, slices));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SysfsCounterMonitorModule::Poll(const absl::Time start,
+                                             const absl::Time end) {
+  RETURN_IF_ERROR(ReadCounters());
+  const std::vector<int64_t>& values = reader_.values();
+
+  const int64_t max_per_day = source_.threshold().max_count_per_day();
+  std::vector<int> newly_exceeded;
+  for (size_t i = 0; i < values.size(); ++i) {
+    google::protobuf::Value val;
+    val.set_number_value(values[i]);
+    series_[i]->AddElement(val);
+    if (histories_[i] != nullptr) {
+      histories_[i]->Append(end, values[i]);
+    }
+    // A counter that went backwards was reset; count from the new value.
+    if (values[i] < day_baselines_[i]) {
+      day_baselines_[i] = values[i];
+    }
+    if (values[i] - day_baselines_[i] > max_per_day && !exceeded_[i]) {
+      exceeded_[i] = true;
+      newly_exceeded.push_back(i);
+    }
+  }
+  if (end - day_start_ >= absl::Hours(24)) {
+    day_baselines_ = values;
+    day_start_ = end;
+  }
+
+  // One diagnosis per hardware, listing the counters that crossed this poll.
+  std::map<int, std::vector<std::string>> crossed;
+  for (int counter : newly_exceeded) {
+    crossed[counter_hardware_[counter]].push_back(counter_names_[counter]);
+  }
+  for (const auto& [hardware, counters] : crossed) {
+    SysfsHardwareTracker& tracker = hardware_[hardware];
+    tracker.failures.insert(tracker.failures.end(), counters.begin(),
+                            counters.end());
+    ReportFailure(tracker,
+                  absl::StrFormat("excessive-%s-errors", source_.name()),
+                  absl::StrFormat("%s %s errors exceed %d per day, for: %s",
+                                  tracker.name, source_.name(), max_per_day,
+                                  absl::StrJoin(counters, ",")));
+  }
+
+  if (anomaly_detector_ != nullptr) {
+    std::copy(values.begin(), values.end(), detector_values_.begin());
+    for (const RateAnomalyDetector::Alarm& alarm :
+         anomaly_detector_->Update(detector_values_, end - start)) {
+      SysfsHardwareTracker& tracker =
+          hardware_[counter_hardware_[alarm.index]];
+      bool ewma = alarm.kind == RateAnomalyDetector::kEwmaRate;
+      tracker.failures.push_back(
+          absl::StrFormat("%s (%s)", counter_names_[alarm.index],
+                          ewma ? "high rate" : "accelerating"));
+      ReportFailure(
+          tracker,
+          ewma ? absl::StrFormat("high-%s-error-rate", source_.name())
+               : absl::StrFormat("accelerating-%s-errors", source_.name()),
+          absl::StrFormat("%s %s errors %s, at %.2f errors/hour", tracker.name,
+                          counter_names_[alarm.index],
+                          ewma ? "above rate threshold" : "accelerating",
+                          alarm.rate_per_hour));
+    }
+  }
+  return absl::OkStatus();
+}
+
+void SysfsCounterMonitorModule::ReportFailure(SysfsHardwareTracker& tracker,
+                                              const std::string& symptom,
+                                              const std::string& message) {
+  tracker.step->AddDiagnosis(rpb::Diagnosis_Type::Diagnosis_Type_FAIL, symptom,
+                             message, {tracker.hw_record});
+  if (tracker.symptom.empty()) {
+    tracker.symptom = symptom;
+  }
+  if (on_failure_) {
+    on_failure_(symptom, message);
+  }
+}
+
+absl::Status SysfsCounterMonitorModule::StopMonitoring() {
+  for (std::unique_ptr<results::MeasurementSeries>& series : series_) {
+    series->End();
+  }
+  for (SysfsHardwareTracker& tracker : hardware_) {
+    if (!tracker.failures.empty()) {
+      for (int counter : tracker.counters) {
+        if (histories_[counter] == nullptr) continue;
+        if (std::optional<absl::Time> first =
+                histories_[counter]->FirstIncrease();
+            first.has_value()) {
+          tracker.step->LogInfo(absl::StrFormat(
+              "%s first increased at %s, %.2f/hour since",
+              counter_names_[counter], absl::FormatTime(*first),
+              histories_[counter]->RatePerSecond(*first) * 3600));
+        }
+      }
+    }
+    // Failing hardware, over a threshold or with an anomaly alarm, was
+    // diagnosed as it failed.
+    if (tracker.failures.empty()) {
+      tracker.step->AddDiagnosis(
+          rpb::Diagnosis_Type::Diagnosis_Type_PASS,
+          absl::StrFormat("acceptable-%s-errors", source_.name()),
+          absl::StrFormat("%s %s errors are below thresholds.", tracker.name,
+                          source_.name()),
+          {tracker.hw_record});
+    }
+    tracker.step->End();
+  }
+  return absl::OkStatus();
+}
+
+void SysfsCounterMonitorModule::FillSnapshot(MonitorSnapshot& snapshot) const {
+  for (const SysfsHardwareTracker& tracker : hardware_) {
+    for (int counter : tracker.counters) {
+      CounterSnapshot* counter_snapshot = snapshot.add_counters();
+      counter_snapshot->set_name(
+          absl::StrFormat("%s/%s", tracker.name, counter_names_[counter]));
+      counter_snapshot->set_value(reader_.values()[counter]);
+    }
+    const bool failed = !tracker.failures.empty();
+    DiagnosisSnapshot* diagnosis = snapshot.add_diagnoses();
+    diagnosis->set_hardware(tracker.name);
+    diagnosis->set_symptom(
+        failed ? tracker.symptom
+               : absl::StrFormat("acceptable-%s-errors", source_.name()));
+    diagnosis->set_type(failed ? "FAIL" : "PASS");
+    if (failed) {
+      diagnosis->set_message(absl::StrFormat("%s %s errors failed for: %s",
+                                             tracker.name, source_.name(),
+                                             absl::StrJoin(tracker.failures,
+                                                           ",")));
+    }
+  }
+}
+
+}  // namespace ocpdiag::error_monitor
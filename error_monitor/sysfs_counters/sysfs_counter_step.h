@@ -0,0 +1,272 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_SYSFS_COUNTERS_SYSFS_COUNTER_STEP_H_
+#define OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_SYSFS_COUNTERS_SYSFS_COUNTER_STEP_H_
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "ocpdiag/core/results/results.h"
+#include "error_monitor/anomaly_detector.h"
+#include "error_monitor/clock.h"
+#include "error_monitor/counter_history.h"
+#include "error_monitor/error_monitor_module.h"
+#include "error_monitor/params.pb.h"
+#include "error_monitor/readout_source.h"
+#include "lib/numa_info/numa_info.h"
+
+namespace ocpdiag::error_monitor {
+
+// A counter file matched by the source's globs.
+struct SysfsCounterFile {
+  std::string path;
+  // Handle from ReadoutSource::Open, re-read on every poll. -1 if the file is
+  // reopened for every read instead, past the reader's open file limit.
+  int handle = -1;
+  SysfsCounterSource::Format format = SysfsCounterSource::VALUE;
+  // Position of the file's first counter in the module's counter arrays.
+  int first_counter = 0;
+  // Keys of a KEY_VALUE file in the order they appeared at discovery, one
+  // counter each. Empty for VALUE files.
+  std::vector<std::string> keys;
+};
+
+// Counter files read together by one thread, pinned near their devices.
+struct SysfsReadShard {
+  // NUMA node of the shard's devices, or -1 if unknown or not sharding.
+  int numa_node = -1;
+  // CPUs to run the shard's reads on. Empty leaves affinity unchanged.
+  std::vector<int> cpus;
+  // Positions of the shard's files in the module's file table.
+  std::vector<int> files;
+  // Read buffer. sysfs attributes are at most a page.
+  std::array<char, 4096> buffer;
+  // Result of the shard's last read pass.
+  absl::Status status;
+};
+
+// Reads a fixed table of counter files into a packed array of values. Files
+// are opened once; each Read() re-reads all of them in a single pass, or one
+// slice of them. Files beyond set_max_open_files() are opened, read and
+// closed on every read instead.
+//
+// Sharded by NUMA node, each node's files are read by a thread of its own,
+// started once and pinned to that node's CPUs. Each file owns fixed slots in
+// the value array, so the result does not depend on thread timing.
+class SysfsCounterReader {
+ public:
+  // Files are opened and read through `readout`. NUMA topology is read from
+  // the sysfs tree at `sysfs_root`.
+  explicit SysfsCounterReader(ReadoutSource& readout,
+                              absl::string_view sysfs_root = kSysfsRoot)
+      : readout_(readout), sysfs_root_(sysfs_root) {}
+  SysfsCounterReader(const SysfsCounterReader&) = delete;
+  SysfsCounterReader& operator=(const SysfsCounterReader&) = delete;
+  ~SysfsCounterReader();
+
+  // Opens the file at `path` and appends its counters: one for a VALUE file,
+  // or one per key present now for a KEY_VALUE file, possibly none. The
+  // returned file is valid until the next call.
+  absl::StatusOr<const SysfsCounterFile*> AddFile(
+      const std::string& path, SysfsCounterSource::Format format);
+  // Keeps at most `max` of the files added afterwards open between reads.
+  void set_max_open_files(int64_t max) { max_open_files_ = max; }
+  // Splits the files into read shards, by NUMA node if `by_numa_node`, and
+  // starts the shard threads. Call once, after the last AddFile().
+  void Shard(bool by_numa_node);
+  // Reads the `slice`-th of `slices` contiguous, near-equal parts of the file
+  // table into values(). By default reads every file.
+  absl::Status Read(int slice = 0, int slices = 1);
+
+  const std::vector<int64_t>& values() const { return values_; }
+  size_t file_count() const { return files_.size(); }
+  const std::vector<SysfsReadShard>& shards() const { return shards_; }
+
+ private:
+  // Returns the current contents of `file`, read through `buffer`. The view
+  // is valid until `buffer` is reused.
+  absl::StatusOr<absl::string_view> ReadFile(const SysfsCounterFile& file,
+                                             std::array<char, 4096>& buffer);
+  // Reads the shard's files within [begin, end) of the file table into their
+  // slots of `values_`.
+  absl::Status ReadShard(SysfsReadShard& shard, size_t begin, size_t end);
+  // Body of the thread of `shard`: runs a read pass per generation.
+  void RunShard(SysfsReadShard& shard);
+
+  ReadoutSource& readout_;
+  const std::string sysfs_root_;
+  std::vector<SysfsCounterFile> files_;
+  int64_t max_open_files_ = std::numeric_limits<int64_t>::max();
+  int64_t open_files_ = 0;
+  std::vector<SysfsReadShard> shards_;
+  std::vector<int64_t> values_;
+
+  // Shard threads, when there is more than one shard. Read() sets the file
+  // range of the pass, bumps `generation_` to start it and waits for
+  // `pending_` to reach zero.
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  int64_t generation_ = 0;
+  size_t pass_begin_ = 0;
+  size_t pass_end_ = 0;
+  int pending_ = 0;
+  bool stopping_ = false;
+};
+
+struct SysfsHardwareTracker {
+  std::string name;
+  std::unique_ptr<results::TestStep> step;
+  results::HwRecord hw_record;
+  // Positions of the hardware's counters in the module's counter arrays.
+  std::vector<int> counters;
+  // Names of the counters that have crossed their threshold or raised an
+  // anomaly alarm, the latter suffixed with the kind of alarm.
+  std::vector<std::string> failures;
+  // Symptom of the first FAIL diagnosis emitted for the hardware.
+  std::string symptom;
+};
+
+// Monitors one SysfsCounterSource. Counter files are discovered once and
+// compiled into a SysfsCounterReader; each poll reads every file in a single
+// pass into packed counter arrays, then checks them all in one loop.
+//
+// Given a poll window in low-interference mode, the read pass is split into
+// slices of at most internal::kFilesPerReadSlice files spread evenly over the
+// window. Each file is then read at the same offset in every poll.
+//
+// With `numa_sharded_collection` set, the reader is sharded by the NUMA node
+// of each file's device.
+class SysfsCounterMonitorModule : public ErrorMonitorModuleInterface {
+ public:
+  // Counter files are discovered and read through `readout`. Counter
+  // histories are kept in `history`, which may be shared with other modules.
+  explicit SysfsCounterMonitorModule(results::ResultApi& api,
+                                     results::TestRun& test_run,
+                                     const Params& params,
+                                     const SysfsCounterSource& source,
+                                     Clock& clock, ReadoutSource& readout,
+                                     CounterHistory& history)
+      : result_api_(api),
+        test_run_(test_run),
+        params_(params),
+        source_(source),
+        clock_(clock),
+        readout_(readout),
+        reader_(readout),
+        history_(history) {}
+
+  absl::Status LoadHwInfos(results::DutInfo& dut_info) final;
+  absl::Status StartMonitoring() final;
+  absl::Status Poll(const absl::Time start, const absl::Time end) final;
+  absl::Status StopMonitoring() final;
+  void FillSnapshot(MonitorSnapshot& snapshot) const final;
+  void SetFailureCallback(FailureCallback callback) final {
+    on_failure_ = std::move(callback);
+  }
+  void SetPollWindow(absl::Duration window,
+                     WaitUntilFunction wait_until) final {
+    poll_window_ = window;
+    wait_until_ = std::move(wait_until);
+  }
+
+ private:
+  // Paths matching the source's globs, sorted.
+  absl::StatusOr<std::vector<std::string>> DiscoverFiles();
+  // Reads every counter file, spread over `poll_window_` if set.
+  absl::Status ReadCounters();
+  // Emits a FAIL diagnosis for `tracker` and notifies `on_failure_`.
+  void ReportFailure(SysfsHardwareTracker& tracker, const std::string& symptom,
+                     const std::string& message);
+
+  // Test-level data
+  results::ResultApi& result_api_;
+  results::TestRun& test_run_;
+  const Params& params_;
+  const SysfsCounterSource& source_;
+  Clock& clock_;
+  ReadoutSource& readout_;
+
+  SysfsCounterReader reader_;
+  std::vector<SysfsHardwareTracker> hardware_;
+
+  // Per-counter state, indexed by counter position.
+  std::vector<std::string> counter_names_;
+  std::vector<int> counter_hardware_;
+  std::vector<std::unique_ptr<results::MeasurementSeries>> series_;
+  // Values at the start of the current day, for the per-day threshold.
+  std::vector<int64_t> day_baselines_;
+  std::vector<bool> exceeded_;
+  // Compressed history of each counter, owned by `history_`. Null for
+  // counters the budget cannot hold.
+  std::vector<CounterSeries*> histories_;
+  absl::Time day_start_;
+  // Null unless anomaly detection is configured.
+  std::unique_ptr<RateAnomalyDetector> anomaly_detector_;
+  std::vector<double> detector_values_;
+  // Counter history keyed by "{source}/{hardware}/{counter}", shared with
+  // the other modules.
+  CounterHistory& history_;
+  FailureCallback on_failure_;
+  // Time the read pass of a poll may be spread over. Zero reads in one burst.
+  absl::Duration poll_window_ = absl::ZeroDuration();
+  WaitUntilFunction wait_until_;
+};
+
+namespace internal {
+
+// Most files read in one burst when a poll is spread over a window.
+inline constexpr int kFilesPerReadSlice = 64;
+
+// File descriptors left free for sockets, pipes to subprocesses and
+// reopened counter files when deciding how many counter files to keep open.
+inline constexpr int kReservedFileDescriptors = 64;
+
+// Raises the soft RLIMIT_NOFILE to the hard limit, and returns the new soft
+// limit.
+absl::StatusOr<int64_t> RaiseOpenFileLimit();
+
+// Number of file descriptors this process has open, or 0 if unknown.
+int64_t OpenFileCount();
+
+// Expands `name_template` for the counter file at `path`.
+std::string ExpandHardwareName(absl::string_view name_template,
+                               absl::string_view path);
+
+// Parses the "<key> <integer>" lines of a KEY_VALUE file into `values`, where
+// `values[i]` is the counter of `keys[i]`. Lines may come in any order; lines
+// with unknown keys are skipped, and counters whose key is missing keep their
+// value.
+absl::Status ParseKeyValueCounters(absl::string_view contents,
+                                   absl::Span<const std::string> keys,
+                                   absl::Span<int64_t> values);
+
+}  // namespace internal
+}  // namespace ocpdiag::error_monitor
+
+#endif  // OCPDIAG_DIAGNOSTICS_SYSTEM_ERROR_MONITOR_SYSFS_COUNTERS_SYSFS_COUNTER_STEP_H_
@@ -0,0 +1,346 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "error_monitor/sysfs_counters/sysfs_counter_step.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "ocpdiag/core/results/results.h"
+#include "error_monitor/clock.h"
+#include "error_monitor/counter_history.h"
+#include "error_monitor/params.pb.h"
+#include "error_monitor/readout_source.h"
+
+namespace ocpdiag::error_monitor {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+using ::testing::IsEmpty;
+using ::testing::SizeIs;
+
+TEST(ExpandHardwareNameTest, ExpandsComponentsFromEnd) {
+  constexpr absl::string_view kPath = "/sys/class/net/eth0/statistics/rx_crc";
+  EXPECT_EQ(internal::ExpandHardwareName("{-2}", kPath), "statistics");
+  EXPECT_EQ(internal::ExpandHardwareName("{-3}", kPath), "eth0");
+  EXPECT_EQ(internal::ExpandHardwareName("nic-{-3}/{-1}", kPath),
+            "nic-eth0/rx_crc");
+  EXPECT_EQ(internal::ExpandHardwareName("{path}", kPath), kPath);
+}
+
+TEST(ExpandHardwareNameTest, KeepsUnknownTokensAndDropsOutOfRange) {
+  constexpr absl::string_view kPath = "/sys/a/b";
+  EXPECT_EQ(internal::ExpandHardwareName("x{-9}y", kPath), "xy");
+  EXPECT_EQ(internal::ExpandHardwareName("{1}{name}", kPath), "{1}{name}");
+  EXPECT_EQ(internal::ExpandHardwareName("{-1", kPath), "{-1");
+  EXPECT_EQ(internal::ExpandHardwareName("", kPath), "");
+}
+
+class ParseKeyValueCountersTest : public ::testing::Test {
+ protected:
+  absl::Status Parse(absl::string_view contents) {
+    return internal::ParseKeyValueCounters(contents, keys_,
+                                           absl::MakeSpan(values_));
+  }
+
+  const std::vector<std::string> keys_ = {"RxErr", "BadTLP", "BadDLLP"};
+  std::vector<int64_t> values_ = {-1, -1, -1};
+};
+
+TEST_F(ParseKeyValueCountersTest, ParsesKeysInOrder) {
+  ASSERT_TRUE(Parse("RxErr 1\nBadTLP 2\nBadDLLP 3\n").ok());
+  EXPECT_THAT(values_, ElementsAre(1, 2, 3));
+}
+
+TEST_F(ParseKeyValueCountersTest, ParsesReorderedKeys) {
+  ASSERT_TRUE(Parse("BadDLLP 3\n  RxErr\t1\nBadTLP 2\n").ok());
+  EXPECT_THAT(values_, ElementsAre(1, 2, 3));
+}
+
+TEST_F(ParseKeyValueCountersTest, MissingKeysKeepTheirValue) {
+  ASSERT_TRUE(Parse("BadTLP 2\n").ok());
+  EXPECT_THAT(values_, ElementsAre(-1, 2, -1));
+}
+
+TEST_F(ParseKeyValueCountersTest, SkipsUnknownKeys) {
+  ASSERT_TRUE(Parse("RxErr 1\nTOTAL_ERR_COR 9\nBadDLLP 3\n").ok());
+  EXPECT_THAT(values_, ElementsAre(1, -1, 3));
+}
+
+TEST_F(ParseKeyValueCountersTest, RejectsMalformedValue) {
+  absl::Status status = Parse("RxErr 1\nBadTLP many\n");
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(status.message(), HasSubstr("BadTLP"));
+}
+
+// A fake sysfs tree with `kNodes` NUMA nodes, each with two devices holding
+// a VALUE and a KEY_VALUE counter file.
+class SysfsCounterReaderTest : public ::testing::Test {
+ protected:
+  static constexpr int kNodes = 3;
+
+  void SetUp() override {
+    root_ = std::filesystem::path(::testing::TempDir()) / "fake_sysfs";
+    std::filesystem::remove_all(root_);
+    for (int node = 0; node < kNodes; ++node) {
+      Write(absl::StrCat("devices/system/node/node", node, "/cpulist"), "0");
+      for (int device = 0; device < 2; ++device) {
+        std::string dir = absl::StrCat("devices/pci", node, "/dev", device);
+        Write(dir + "/numa_node", absl::StrCat(node, "\n"));
+        paths_.push_back(Write(dir + "/errors", "0\n"));
+        paths_.push_back(Write(dir + "/aer", "RxErr 0\nBadTLP 0\n"));
+      }
+    }
+  }
+
+  std::string Write(const std::string& relative, const std::string& contents) {
+    std::filesystem::path path = root_ / relative;
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream(path) << contents;
+    return path.string();
+  }
+
+  static bool IsKeyValue(absl::string_view path) {
+    return absl::EndsWith(path, "/aer");
+  }
+  static SysfsCounterSource::Format FormatOf(absl::string_view path) {
+    return IsKeyValue(path) ? SysfsCounterSource::KEY_VALUE
+                            : SysfsCounterSource::VALUE;
+  }
+
+  void AddFiles(SysfsCounterReader& reader) {
+    for (const std::string& path : paths_) {
+      ASSERT_TRUE(reader.AddFile(path, FormatOf(path)).ok());
+    }
+  }
+
+  // Reads the tree once with and once without sharding.
+  void ReadBoth(std::vector<int64_t>& unsharded,
+                std::vector<int64_t>& sharded) {
+    for (bool by_node : {false, true}) {
+      SysfsCounterReader reader(readout_, root_.string());
+      AddFiles(reader);
+      reader.Shard(by_node);
+      EXPECT_THAT(reader.shards(), SizeIs(by_node ? kNodes : 1));
+      ASSERT_TRUE(reader.Read().ok());
+      (by_node ? sharded : unsharded) = reader.values();
+    }
+  }
+
+  std::filesystem::path root_;
+  std::vector<std::string> paths_;
+  LiveReadoutSource readout_;
+};
+
+TEST_F(SysfsCounterReaderTest, ShardsByNumaNode) {
+  SysfsCounterReader reader(readout_, root_.string());
+  AddFiles(reader);
+  reader.Shard(true);
+  ASSERT_THAT(reader.shards(), SizeIs(kNodes));
+  for (int node = 0; node < kNodes; ++node) {
+    EXPECT_EQ(reader.shards()[node].numa_node, node);
+    EXPECT_THAT(reader.shards()[node].files, SizeIs(4));
+  }
+}
+
+TEST_F(SysfsCounterReaderTest, ShardedReadsMatchUnsharded) {
+  for (int i = 0; i < static_cast<int>(paths_.size()); ++i) {
+    std::ofstream(paths_[i]) << (IsKeyValue(paths_[i])
+                                     ? absl::StrCat("BadTLP ", i, "\nRxErr 1\n")
+                                     : absl::StrCat(i, "\n"));
+  }
+  std::vector<int64_t> unsharded, sharded;
+  ReadBoth(unsharded, sharded);
+  EXPECT_THAT(unsharded, SizeIs(18));
+  EXPECT_EQ(sharded, unsharded);
+  EXPECT_THAT(absl::MakeSpan(unsharded).subspan(0, 3), ElementsAre(0, 1, 1));
+}
+
+TEST_F(SysfsCounterReaderTest, ShardThreadsServeRepeatedReads) {
+  SysfsCounterReader reader(readout_, root_.string());
+  AddFiles(reader);
+  reader.Shard(true);
+  for (int poll = 1; poll <= 50; ++poll) {
+    std::ofstream(paths_.back()) << "RxErr " << poll << "\nBadTLP 0\n";
+    ASSERT_TRUE(reader.Read().ok());
+    ASSERT_EQ(reader.values()[reader.values().size() - 2], poll);
+  }
+}
+
+TEST_F(SysfsCounterReaderTest, SlicesReadConsecutiveFiles) {
+  SysfsCounterReader reader(readout_, root_.string());
+  AddFiles(reader);
+  reader.Shard(true);
+  for (const std::string& path : paths_) {
+    std::ofstream(path) << (IsKeyValue(path) ? "RxErr 1\nBadTLP 1\n" : "1\n");
+  }
+  std::vector<int> counters_read;
+  for (int slice = 0; slice < 5; ++slice) {
+    ASSERT_TRUE(reader.Read(slice, 5).ok());
+    counters_read.push_back(
+        std::count(reader.values().begin(), reader.values().end(), 1));
+  }
+  // Files [0, 2), [2, 4), [4, 7), [7, 9) and [9, 12), alternating between 1
+  // and 2 counters.
+  EXPECT_THAT(counters_read, ElementsAre(3, 6, 10, 13, 18));
+}
+
+TEST_F(SysfsCounterReaderTest, ShardReadErrorIsReturned) {
+  SysfsCounterReader reader(readout_, root_.string());
+  AddFiles(reader);
+  reader.Shard(true);
+  std::ofstream(paths_[0]) << "garbage\n";
+  absl::Status status = reader.Read();
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(status.message(), HasSubstr(paths_[0]));
+}
+
+TEST_F(SysfsCounterReaderTest, FilesPastOpenLimitAreReopened) {
+  for (int i = 0; i < static_cast<int>(paths_.size()); ++i) {
+    std::ofstream(paths_[i]) << (IsKeyValue(paths_[i])
+                                     ? absl::StrCat("BadTLP ", i, "\nRxErr 1\n")
+                                     : absl::StrCat(i, "\n"));
+  }
+  std::vector<int64_t> unsharded, sharded;
+  ReadBoth(unsharded, sharded);
+
+  const int64_t open_before = internal::OpenFileCount();
+  SysfsCounterReader reader(readout_, root_.string());
+  reader.set_max_open_files(2);
+  AddFiles(reader);
+  EXPECT_EQ(internal::OpenFileCount() - open_before, 2);
+  reader.Shard(true);
+  ASSERT_TRUE(reader.Read().ok());
+  EXPECT_EQ(reader.values(), unsharded);
+}
+
+TEST(RaiseOpenFileLimitTest, RaisesSoftLimitToHardLimit) {
+  absl::StatusOr<int64_t> limit = internal::RaiseOpenFileLimit();
+  ASSERT_TRUE(limit.ok()) << limit.status();
+  rlimit current;
+  ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &current), 0);
+  EXPECT_EQ(current.rlim_cur, current.rlim_max);
+  EXPECT_GT(*limit, internal::OpenFileCount());
+}
+
+TEST_F(SysfsCounterReaderTest, KeyValueFileWithoutKeysHasNoCounters) {
+  const std::string empty = Write("devices/pci0/dev9/aer", "");
+  const std::string value = Write("devices/pci0/dev9/errors", "7\n");
+  SysfsCounterReader reader(readout_, root_.string());
+  absl::StatusOr<const SysfsCounterFile*> file =
+      reader.AddFile(empty, SysfsCounterSource::KEY_VALUE);
+  ASSERT_TRUE(file.ok()) << file.status();
+  EXPECT_EQ((*file)->format, SysfsCounterSource::KEY_VALUE);
+  EXPECT_THAT((*file)->keys, IsEmpty());
+  ASSERT_TRUE(reader.AddFile(value, SysfsCounterSource::VALUE).ok());
+  reader.Shard(false);
+
+  // Keys that appear later are not counters, and do not break the read.
+  std::ofstream(empty) << "RxErr 1\n";
+  ASSERT_TRUE(reader.Read().ok());
+  EXPECT_THAT(reader.values(), ElementsAre(7));
+}
+
+// Runs a module over a fake tree of VALUE files.
+class SysfsCounterMonitorModuleTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = std::filesystem::path(::testing::TempDir()) / "module_sysfs";
+    std::filesystem::remove_all(root_);
+    source_ = params_.add_sysfs_counters();
+    source_->set_name("fake");
+    absl::StatusOr<std::unique_ptr<results::TestRun>> test_run =
+        api_.InitializeTestRun("sysfs-counter-test");
+    ASSERT_TRUE(test_run.ok()) << test_run.status();
+    test_run_ = *std::move(test_run);
+  }
+
+  void Write(const std::string& relative) {
+    std::filesystem::path path = root_ / relative;
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream(path) << "0\n";
+  }
+
+  std::unique_ptr<SysfsCounterMonitorModule> MakeModule(
+      const std::string& glob) {
+    source_->add_globs((root_ / glob).string());
+    return std::make_unique<SysfsCounterMonitorModule>(
+        api_, *test_run_, params_, *source_, clock_, readout_, history_);
+  }
+
+  std::filesystem::path root_;
+  Params params_;
+  SysfsCounterSource* source_;
+  SimulatedClock clock_{absl::FromUnixSeconds(0)};
+  LiveReadoutSource readout_;
+  CounterHistory history_{64 * 1024};
+  results::ResultApi api_;
+  std::unique_ptr<results::TestRun> test_run_;
+  results::DutInfo dut_info_{"dut"};
+};
+
+TEST_F(SysfsCounterMonitorModuleTest, SpreadsReadsOverPollWindow) {
+  // Three slices of 64 files.
+  for (int i = 0; i < 192; ++i) {
+    Write(absl::StrCat("dev", i, "/errors"));
+  }
+  std::unique_ptr<SysfsCounterMonitorModule> module =
+      MakeModule("dev*/errors");
+  ASSERT_TRUE(module->LoadHwInfos(dut_info_).ok());
+  ASSERT_TRUE(module->StartMonitoring().ok());
+
+  std::vector<absl::Duration> waits;
+  module->SetPollWindow(absl::Seconds(30), [&](absl::Time deadline) {
+    waits.push_back(deadline - absl::FromUnixSeconds(0));
+    return true;
+  });
+  ASSERT_TRUE(module->Poll(clock_.Now(), clock_.Now()).ok());
+  EXPECT_THAT(waits, ElementsAre(absl::Seconds(10), absl::Seconds(20)));
+  ASSERT_TRUE(module->StopMonitoring().ok());
+}
+
+TEST_F(SysfsCounterMonitorModuleTest, RejectsTemplateMergingCounters) {
+  Write("net/eth0/statistics/rx_crc_errors");
+  Write("net/eth1/statistics/rx_crc_errors");
+  // The default "{-2}" names both NICs "statistics".
+  std::unique_ptr<SysfsCounterMonitorModule> module =
+      MakeModule("net/*/statistics/rx_crc_errors");
+  absl::Status status = module->LoadHwInfos(dut_info_);
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(status.message(), HasSubstr("statistics/rx_crc_errors"));
+
+  source_->set_hardware_name_template("{-3}");
+  module = MakeModule("net/*/statistics/rx_crc_errors");
+  EXPECT_TRUE(module->LoadHwInfos(dut_info_).ok());
+}
+
+}  // namespace
+}  // namespace ocpdiag::error_monitor
@@ -0,0 +1,106 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/numa_info/numa_info.h"
+
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+
+namespace ocpdiag {
+
+namespace {
+
+std::optional<std::string> ReadSmallFile(const std::filesystem::path& path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    return std::nullopt;
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+}  // namespace
+
+int NumaNodeOfSysfsPath(absl::string_view path, absl::string_view sysfs_root) {
+  std::error_code error;
+  std::filesystem::path dir =
+      std::filesystem::canonical(std::string(path), error).parent_path();
+  if (error) {
+    return -1;
+  }
+  std::filesystem::path root =
+      std::filesystem::weakly_canonical(std::string(sysfs_root), error);
+  if (error) {
+    return -1;
+  }
+  for (; dir != dir.root_path() && dir != root; dir = dir.parent_path()) {
+    std::optional<std::string> contents = ReadSmallFile(dir / "numa_node");
+    int node;
+    if (contents.has_value() && absl::SimpleAtoi(*contents, &node)) {
+      return node;
+    }
+  }
+  return -1;
+}
+
+std::vector<int> CpusOfNumaNode(int node, absl::string_view sysfs_root) {
+  if (node < 0) {
+    return {};
+  }
+  std::optional<std::string> contents = ReadSmallFile(absl::StrCat(
+      sysfs_root, "/devices/system/node/node", node, "/cpulist"));
+  if (!contents.has_value()) {
+    return {};
+  }
+  return ParseCpuList(*contents).value_or(std::vector<int>());
+}
+
+std::optional<std::vector<int>> ParseCpuList(absl::string_view cpulist) {
+  std::vector<int> cpus;
+  for (absl::string_view range :
+       absl::StrSplit(absl::StripAsciiWhitespace(cpulist), ',',
+                      absl::SkipEmpty())) {
+    std::pair<absl::string_view, absl::string_view> bounds =
+        absl::StrSplit(range, absl::MaxSplits('-', 1));
+    int first, last;
+    if (!absl::SimpleAtoi(bounds.first, &first)) {
+      return std::nullopt;
+    }
+    last = first;
+    if (!bounds.second.empty() && !absl::SimpleAtoi(bounds.second, &last)) {
+      return std::nullopt;
+    }
+    if (first < 0 || last < first) {
+      return std::nullopt;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+}  // namespace ocpdiag
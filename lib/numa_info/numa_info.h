@@ -0,0 +1,45 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OCPDIAG_DIAGNOSTICS_LIB_NUMA_INFO_NUMA_INFO_H_
+#define OCPDIAG_DIAGNOSTICS_LIB_NUMA_INFO_NUMA_INFO_H_
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace ocpdiag {
+
+// Where sysfs is mounted. Functions below take the root as a parameter so
+// that tests and benchmarks can point them at a fake tree.
+inline constexpr char kSysfsRoot[] = "/sys";
+
+// Returns the NUMA node of the device a sysfs attribute belongs to, read from
+// the nearest `numa_node` attribute in the same directory or above it, up to
+// `sysfs_root`. Returns -1 if the node is unknown.
+int NumaNodeOfSysfsPath(absl::string_view path,
+                        absl::string_view sysfs_root = kSysfsRoot);
+
+// Returns the CPUs of NUMA node `node`, or an empty list if unknown.
+std::vector<int> CpusOfNumaNode(int node,
+                                absl::string_view sysfs_root = kSysfsRoot);
+
+// Parses a kernel cpulist such as "0-3,8,10-11".
+std::optional<std::vector<int>> ParseCpuList(absl::string_view cpulist);
+
+}  // namespace ocpdiag
+
+#endif  // OCPDIAG_DIAGNOSTICS_LIB_NUMA_INFO_NUMA_INFO_H_